@@ -0,0 +1,252 @@
+//
+//  AT Command Latency
+//
+//  The histograms live in .noinit and are guarded by a CRC, like the
+//  water level monitor's retained state, so that they carry on across
+//  software reboots.
+//
+
+#include "ATLatency.h"
+
+#if ATLATENCY_ENABLED
+
+#include <ctype.h>
+#include <stddef.h>
+#include <util/crc16.h>
+#include "SystemTime.h"
+#include "StringUtils.h"
+
+// longest command name that is timed separately
+#define MAX_NAME_LEN 9
+#define NOT_PENDING 0xFF
+
+// command types, in the same order as the name table
+typedef enum CommandType_enum {
+    ct_CDNSGIP,
+    ct_CGATT,
+    ct_CIFSR,
+    ct_CIICR,
+    ct_CIPCLOSE,
+    ct_CIPSEND,
+    ct_CIPSHUT,
+    ct_CIPSTART,
+    ct_CIPSTATUS,
+    ct_CREG,
+    ct_CSTT,
+    ct_other
+} CommandType;
+
+static char cdnsgipP[]      PROGMEM = "CDNSGIP";
+static char cgattP[]        PROGMEM = "CGATT";
+static char cifsrP[]        PROGMEM = "CIFSR";
+static char ciicrP[]        PROGMEM = "CIICR";
+static char cipcloseP[]     PROGMEM = "CIPCLOSE";
+static char cipsendP[]      PROGMEM = "CIPSEND";
+static char cipshutP[]      PROGMEM = "CIPSHUT";
+static char cipstartP[]     PROGMEM = "CIPSTART";
+static char cipstatusP[]    PROGMEM = "CIPSTATUS";
+static char cregP[]         PROGMEM = "CREG";
+static char csttP[]         PROGMEM = "CSTT";
+static char otherP[]        PROGMEM = "other";
+
+typedef struct CommandTypeDescriptor_struct {
+    PGM_P name;
+} CommandTypeDescriptor;
+
+// table must be maintained in case-insensitive ASCII collation order,
+// and in sync with the CommandType enum
+static CommandTypeDescriptor commandTypeTable[] PROGMEM =
+{
+    {cdnsgipP},
+    {cgattP},
+    {cifsrP},
+    {ciicrP},
+    {cipcloseP},
+    {cipsendP},
+    {cipshutP},
+    {cipstartP},
+    {cipstatusP},
+    {cregP},
+    {csttP}
+};
+static const int commandTypeTableSize =
+    sizeof(commandTypeTable) / sizeof(CommandTypeDescriptor);
+
+typedef struct Histograms_struct {
+    uint8_t counts[ATLatency_numCommandTypes][ATLatency_numBuckets];
+    uint16_t crc;
+} Histograms;
+static Histograms latencyHistograms __attribute__ ((section (".noinit")));
+
+// the command being timed
+static uint8_t pendingType = NOT_PENDING;
+static SystemTime_t sentTime;
+
+static uint16_t histogramsCRC (void)
+{
+    uint16_t crc = 0xFFFF;
+    const uint8_t *bytes = (const uint8_t*)&latencyHistograms;
+    for (uint16_t i = 0; i < offsetof(Histograms, crc); ++i) {
+        crc = _crc_ccitt_update(crc, bytes[i]);
+    }
+    return crc;
+}
+
+static uint8_t typeOfName (
+    const CharString_t *name)
+{
+    CharStringSpan_t nameSpan;
+    CharStringSpan_init(name, &nameSpan);
+    return ATLatency_lookupCommandType(&nameSpan);
+}
+
+static void startTiming (
+    const uint8_t commandType)
+{
+    pendingType = commandType;
+    SystemTime_getCurrentTime(&sentTime);
+}
+
+static void recordLatency (void)
+{
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    const int32_t hundredths =
+        (SystemTime_diffSec(&curTime, &sentTime) * 100) +
+        ((int16_t)curTime.hundredths - (int16_t)sentTime.hundredths);
+
+    uint8_t bucket = 0;
+    int32_t limit = 8;
+    while ((hundredths >= limit) && (bucket < (ATLatency_numBuckets - 1))) {
+        ++bucket;
+        limit <<= 1;
+    }
+
+    uint8_t *counts = latencyHistograms.counts[pendingType];
+    if (counts[bucket] == 255) {
+        for (uint8_t b = 0; b < ATLatency_numBuckets; ++b) {
+            counts[b] >>= 1;
+        }
+    }
+    ++counts[bucket];
+    latencyHistograms.crc = histogramsCRC();
+
+    pendingType = NOT_PENDING;
+}
+
+void ATLatency_Initialize (void)
+{
+    pendingType = NOT_PENDING;
+    if ((SystemTime_LastReboot() != lrb_software) ||
+        (latencyHistograms.crc != histogramsCRC())) {
+        uint8_t *bytes = (uint8_t*)&latencyHistograms;
+        for (uint16_t i = 0; i < sizeof(latencyHistograms); ++i) {
+            bytes[i] = 0;
+        }
+        latencyHistograms.crc = histogramsCRC();
+    }
+}
+
+void ATLatency_commandSentP (
+    PGM_P command)
+{
+    CharString_define(MAX_NAME_LEN, name);
+    if ((pgm_read_byte(&command[0]) == 'A') &&
+        (pgm_read_byte(&command[1]) == 'T') &&
+        (pgm_read_byte(&command[2]) == '+')) {
+        command += 3;
+        char c;
+        while (isalpha(c = pgm_read_byte(command++)) &&
+               (CharString_length(&name) < MAX_NAME_LEN)) {
+            CharString_appendC(c, &name);
+        }
+    }
+    startTiming(typeOfName(&name));
+}
+
+void ATLatency_commandSentCS (
+    const CharString_t *command)
+{
+    CharString_define(MAX_NAME_LEN, name);
+    CharString_Iter iter = CharString_begin(command);
+    const CharString_Iter end = CharString_end(command);
+    if (((end - iter) > 3) &&
+        (iter[0] == 'A') && (iter[1] == 'T') && (iter[2] == '+')) {
+        iter += 3;
+        while ((iter != end) && isalpha(*iter) &&
+               (CharString_length(&name) < MAX_NAME_LEN)) {
+            CharString_appendC(*iter++, &name);
+        }
+    }
+    startTiming(typeOfName(&name));
+}
+
+void ATLatency_responseReceived (
+    const SIM800_ResponseMessage msg)
+{
+    bool isFinal = false;
+    switch (pendingType) {
+        case NOT_PENDING :
+            break;
+        case ct_CIPSTART :
+            isFinal =
+                (msg == rm_CONNECT_OK) || (msg == rm_CONNECT_FAIL) ||
+                (msg == rm_ERROR) || (msg == rm_CLOSED);
+            break;
+        case ct_CIPSEND :
+            isFinal =
+                (msg == rm_SEND_OK) || (msg == rm_SEND_FAIL) ||
+                (msg == rm_ERROR) || (msg == rm_CLOSED);
+            break;
+        case ct_CIPCLOSE :
+            isFinal =
+                (msg == rm_CLOSE_OK) || (msg == rm_ERROR) || (msg == rm_CLOSED);
+            break;
+        case ct_CIPSHUT :
+            isFinal = (msg == rm_SHUT_OK) || (msg == rm_ERROR);
+            break;
+        case ct_CIFSR :
+        case ct_CDNSGIP :
+            // the result is the address (see ATLatency_resultReceived)
+            isFinal = (msg == rm_ERROR);
+            break;
+        default:
+            isFinal = (msg == rm_OK) || (msg == rm_ERROR);
+            break;
+    }
+    if (isFinal) {
+        recordLatency();
+    }
+}
+
+void ATLatency_resultReceived (void)
+{
+    if (pendingType != NOT_PENDING) {
+        recordLatency();
+    }
+}
+
+uint8_t ATLatency_lookupCommandType (
+    const CharStringSpan_t *name)
+{
+    return (uint8_t)StringUtils_lookupNameNocase(
+        name, commandTypeTable,
+        sizeof(CommandTypeDescriptor), commandTypeTableSize);
+}
+
+PGM_P ATLatency_commandTypeName (
+    const uint8_t commandType)
+{
+    return (commandType < commandTypeTableSize)
+        ? (PGM_P)pgm_read_word(&commandTypeTable[commandType].name)
+        : otherP;
+}
+
+uint8_t ATLatency_count (
+    const uint8_t commandType,
+    const uint8_t bucket)
+{
+    return latencyHistograms.counts[commandType][bucket];
+}
+
+#endif  // ATLATENCY_ENABLED
@@ -0,0 +1,73 @@
+//
+//  AT Command Latency
+//
+//  What it does:
+//     Keeps a histogram, for each type of AT command, of how long the cell
+//     module took to give the command's final result. Buckets are on a
+//     log scale: bucket 0 holds latencies under 80ms and each bucket after
+//     it holds latencies up to twice as long as the one before, with the
+//     last one holding everything from 5.12 seconds up. The histograms
+//     survive sleep and software reboots.
+//
+//  How to use it:
+//     Call ATLatency_commandSentP() or ATLatency_commandSentCS() with each
+//     command as it is sent, and ATLatency_responseReceived() with each
+//     response message. Results that aren't response messages (an IP
+//     address, a +CDNSGIP report, DATA ACCEPT) are passed to
+//     ATLatency_resultReceived(). Only one command is timed at a time;
+//     sending another command before a result arrives abandons the first.
+//
+
+#ifndef ATLATENCY_H
+#define ATLATENCY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "CharString.h"
+#include "CharStringSpan.h"
+#include "SIM800.h"
+
+// enable/disable the histograms and the "latency" command. They don't fit
+// in flash along with everything else, so they're left out of normal builds
+#define ATLATENCY_ENABLED 0
+
+// commands that are timed separately. all other commands share the last
+// histogram
+#define ATLatency_numCommandTypes 12
+#define ATLatency_numBuckets 8
+
+#if ATLATENCY_ENABLED
+extern void ATLatency_Initialize (void);
+
+extern void ATLatency_commandSentP (
+    PGM_P command);
+extern void ATLatency_commandSentCS (
+    const CharString_t *command);
+extern void ATLatency_responseReceived (
+    const SIM800_ResponseMessage msg);
+extern void ATLatency_resultReceived (void);
+
+// returns the type of the command with the given name (such as "CREG"),
+// or ATLatency_numCommandTypes if it isn't one that is timed separately
+extern uint8_t ATLatency_lookupCommandType (
+    const CharStringSpan_t *name);
+extern PGM_P ATLatency_commandTypeName (
+    const uint8_t commandType);
+// counts are halved when one of a histogram's buckets fills up, so they
+// show the shape of the distribution rather than totals
+extern uint8_t ATLatency_count (
+    const uint8_t commandType,
+    const uint8_t bucket);
+#else
+inline void ATLatency_Initialize (void) {}
+inline void ATLatency_commandSentP (
+    PGM_P command) {}
+inline void ATLatency_commandSentCS (
+    const CharString_t *command) {}
+inline void ATLatency_responseReceived (
+    const SIM800_ResponseMessage msg) {}
+inline void ATLatency_resultReceived (void) {}
+#endif
+
+#endif  // ATLATENCY_H
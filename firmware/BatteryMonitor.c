@@ -13,7 +13,7 @@
 #include "ADCManager.h"
 #include "SystemTime.h"
 #include "DataHistory.h"
-#include "EEPROMStorage.h"
+#include "SettingsShadow.h"
 
 #define BATTERY_ADC_CHANNEL ADC_SINGLE_ENDED_INPUT_ADC0
 
@@ -104,7 +104,7 @@ void BatteryMonitor_task (void)
             if (ADCManager_ConversionIsComplete(&batteryVoltage)) {
                 // apply calibration
                 const uint16_t batteryVoltageCalibrated =
-                    (((uint32_t)batteryVoltage) * EEPROMStorage_batteryVoltageCal()) / 100;
+                    (((uint32_t)batteryVoltage) * SettingsShadow_batteryVoltageCal()) / 100;
 
                 DataHistory_insertValue(batteryVoltageCalibrated, &batteryVoltageHistory);
 
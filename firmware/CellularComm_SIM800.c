@@ -15,15 +15,32 @@
 #include "TCPIPConsole.h"
 #include "Console.h"
 #include "EEPROMStorage.h"
+#include "SettingsShadow.h"
 #include "StringUtils.h"
+#include "ScratchArena.h"
+#include "NetworkCache.h"
+#include "SessionJournal.h"
+#include "ATLatency.h"
+#include "EEPROM_Util.h"
 #include <stdlib.h>
 #include <string.h>
 #include <avr/io.h>
 #include <avr/interrupt.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
 
 #define CONSULT_PINJUMPER 0
 #define USE_CMGL 0
 #define DEBUG_TRACE 0
+// configure the module with one command line and keep the configuration
+// in its saved profile, instead of sending each command separately at
+// every power up
+#define CONCATENATED_BRINGUP 1
+// leave the module in slow-clock sleep (AT+CSCLK=2) between closely
+// spaced posts, when that costs less than powering it down and cold
+// starting it again. off in normal builds, since it doesn't fit in flash
+// along with everything else
+#define USE_MODEM_SLEEP 0
 
 #define PINJUMPER_PIN       PD4
 #define PINJUMPER_INPORT    PIND
@@ -34,6 +51,33 @@
 // the system will commence shutdown and reboot
 #define STATE_TIMEOUT_TIME 12000L
 
+// while waiting to register, the module reports registration changes as
+// they happen. if no report arrives within this many hundredths of a
+// second we ask for the registration status in case a report was missed
+#define CREG_RECHECK_TIME 1000
+
+// if the module hasn't accepted the cached network within this many
+// hundredths of a second we switch it to automatic network selection
+#define NETWORK_CACHE_TIMEOUT 3000
+
+#if USE_MODEM_SLEEP
+// energy model for choosing between sleeping the module and powering it
+// down. currents are in milliamps on the peripheral power rail.
+// average current while the module is awake and running sessions
+#define MODEM_ACTIVE_CURRENT 160
+// rail current while the module sleeps (the rail has to stay on for it)
+#define MODEM_SLEEP_CURRENT 3
+// seconds for a sleeping module to wake and confirm its registration
+#define MODEM_WAKE_TIME 2
+// tenths of a second from power up to a TCP connection, assumed until
+// a cold start has been measured
+#define DEFAULT_COLD_START_TIME 300
+// a sleeping module misses the character that wakes it, so AT is sent
+// up to this many times, this many hundredths of a second apart
+#define MODEM_WAKE_ATTEMPTS 5
+#define MODEM_WAKE_RETRY_TIME 20
+#endif
+
 typedef enum SMSMessageStatus_enum {
     sms_unknown,
     sms_recUnread,
@@ -91,7 +135,17 @@ typedef enum CellularCommState_enum {
     ccs_waitingForCCLKResponse,
     ccs_waitingForCSQResponse,
     ccs_waitingForCBCResponse,
-    ccs_runningTCPIPSubtask
+    ccs_runningTCPIPSubtask,
+    ccs_waitingForBringupResponse,
+    ccs_waitingForProfileSaveResponse,
+    ccs_waitingForProfileCheckResponse,
+    ccs_waitingForCachedNetworkResponse,
+    ccs_waitingForAutomaticNetworkResponse,
+    ccs_waitingForNetworkQueryResponse,
+    ccs_waitingForSleepResponse,
+    ccs_sleeping,
+    ccs_waitingForWakeResponse,
+    ccs_waitingForSleepDisableResponse
 } CellularCommState;
 // state variables
 static bool ccEnabled;
@@ -107,14 +161,35 @@ static SystemTime_t nextCheckForIncomingSMSMessageTime;
 static SMSMessageStatus CMGLSMSMessageStatus;
 static SMSMessageStatus incomingSMSMessageStatus;
 CharString_define(16, incomingSMSMessagePhoneNumber)
-CharString_define(80, incomingSMSMessageText)
+static CharString_t incomingSMSMessageText;
 static MessageIDQueue_type incomingSMSMessageIDs;
 static MessageIDQueue_ValueType currentlyProcessingMessageID;
 static bool gotCMGRMessage;
 
 // variables for outgoing SMS messages
 CharString_define(16, outgoingSMSMessagePhoneNumber)
-CharString_define(80, outgoingSMSMessageText)
+static CharString_t outgoingSMSMessageText;
+
+// the message texts are only needed from when an incoming message is
+// read until its reply has been sent, so they come from the scratch arena
+#define SMS_MESSAGE_TEXT_LEN 80
+static bool inSMSPhase;
+static ScratchArena_Mark smsPhaseMark;
+
+#if CONCATENATED_BRINGUP
+// CRC of the bring-up command line that was last saved in the SIM800's
+// profile with AT&W. when it matches the command line we would send, the
+// module should power up already configured. that is confirmed by asking
+// it for its IP settings (a module that lost its profile reports the
+// defaults) before bring-up is skipped.
+// erased EEPROM reads as NO_MODEM_PROFILE
+#define NO_MODEM_PROFILE 0xFFFF
+#define SETTING_NOT_REPORTED -1
+static uint16_t savedModemProfile EEMEM;
+static uint16_t modemProfile;
+static int16_t moduleCIPHEAD;
+static int16_t moduleCIPQSEND;
+#endif
 
 // variables for cell registration, network time, etc
 static SystemTime_t nextCheckForNetworkTimeAndCSQTime;
@@ -125,6 +200,7 @@ static SIM800_NetworkTime currentNetworkTime;
 static bool gotCREG;
 static uint8_t cregStatus;
 static bool gotSignalQuality;
+static bool signalQualityKnown;
 static uint8_t signalQuality;
 static bool gotCPIN;
 CharString_define(10, cpinStatus);
@@ -132,6 +208,23 @@ static uint8_t batteryChargeStatus;
 static uint8_t batteryPercent;
 static uint16_t batteryMillivolts;
 
+// variables for network selection
+static SystemTime_t powerupTime;
+static uint16_t registrationTime;
+static CellularComm_NetworkSelection networkSelection;
+// operator reported by the module, held until it reports the band
+CharString_define(NetworkCache_maxOperatorLength, networkOperator);
+
+#if USE_MODEM_SLEEP
+// variables for modem sleep. the module stays asleep while we sleep, so
+// these are not reset by CellularComm_Initialize
+static bool modemAsleep;
+static bool sleepRequested;
+static bool measuringColdStart;
+static uint16_t coldStartTime = DEFAULT_COLD_START_TIME;
+static uint8_t wakeAttempts;
+#endif
+
 // variables for responses from SIM800
 static SIM800_ResponseMessage SIM800ResponseMsg;
 static bool gotSIM800Prompt;
@@ -220,7 +313,9 @@ static void CSQCallback (
     const int16_t sigStrength)
 {
     gotSignalQuality = true;
+    signalQualityKnown = true;
     signalQuality = sigStrength;
+    SessionJournal_noteSignalQuality(sigStrength);
 }
 
 static void CREGCallback (
@@ -252,6 +347,20 @@ static void CPINCallback (
         &cpinStatus);
 }
 
+#if CONCATENATED_BRINGUP
+static void CIPHEADCallback (
+    const int16_t mode)
+{
+    moduleCIPHEAD = mode;
+}
+
+static void CIPQSENDCallback (
+    const int16_t mode)
+{
+    moduleCIPQSEND = mode;
+}
+#endif
+
 static void CCLKCallback (
     const SIM800_NetworkTime *time)
 {
@@ -269,6 +378,25 @@ static void CBCCallback (
     batteryMillivolts = millivolts;
 }
 
+static void COPSCallback (
+    const CharStringSpan_t *oper)
+{
+    CharString_copyIters(
+        CharStringSpan_begin(oper),
+        CharStringSpan_end(oper),
+        &networkOperator);
+}
+
+static void CBANDCallback (
+    const CharStringSpan_t *band)
+{
+    // the band is reported after the operator. remember both so the
+    // next power up can ask for this network
+    CharStringSpan_t oper;
+    CharStringSpan_init(&networkOperator, &oper);
+    NetworkCache_update(&oper, band);
+}
+
 static void promptCallback (
     void)
 {
@@ -280,6 +408,7 @@ static void sendSIM800CommandP (
 {
     SIM800_setResponseMessageCallback(responseCallback);
     SIM800ResponseMsg = rm_noResponseYet;
+    ATLatency_commandSentP(command);
     SIM800_sendLineP(command);
 }
 
@@ -288,9 +417,35 @@ static void sendSIM800CommandCS (
 {
     SIM800_setResponseMessageCallback(responseCallback);
     SIM800ResponseMsg = rm_noResponseYet;
+    ATLatency_commandSentCS(command);
     SIM800_sendLineCS(command);
 }
 
+static bool beginSMSPhase (void)
+{
+    if (!inSMSPhase) {
+        smsPhaseMark = ScratchArena_phaseMark();
+        if (ScratchArena_allocPhaseString(SMS_MESSAGE_TEXT_LEN, &incomingSMSMessageText) &&
+            ScratchArena_allocPhaseString(SMS_MESSAGE_TEXT_LEN, &outgoingSMSMessageText)) {
+            inSMSPhase = true;
+        } else {
+            ScratchArena_initEmptyString(&incomingSMSMessageText);
+            ScratchArena_releasePhase(smsPhaseMark);
+        }
+    }
+    return inSMSPhase;
+}
+
+static void endSMSPhase (void)
+{
+    ScratchArena_initEmptyString(&incomingSMSMessageText);
+    ScratchArena_initEmptyString(&outgoingSMSMessageText);
+    if (inSMSPhase) {
+        ScratchArena_releasePhase(smsPhaseMark);
+        inSMSPhase = false;
+    }
+}
+
 #if USE_CMGL
 static void sendCMGLCommand (
     const SMSMessageStatus requestedStatus)
@@ -359,11 +514,104 @@ static void sendCBCCommand (void)
     sendSIM800CommandP(PSTR("AT+CBC"));
 }
 
+// turns on unsolicited registration reports and asks for the current
+// registration status. from then on cregStatus follows the reports
+static void requestRegistrationStatus (void)
+{
+    gotCREG = false;
+    sendSIM800CommandP(PSTR("AT+CREG=1;+CREG?"));
+}
+
+static bool gotRegistrationStatus (void)
+{
+    return (gotCREG && (SIM800ResponseMsg == rm_OK));
+}
+
+// asks the module for the cached network first. with COPS mode 4 the
+// module itself falls back to automatic selection if it can't register
+// on the requested operator
+static void sendCachedNetworkCommand (void)
+{
+    CharString_define(56, command);
+    CharString_copyP(PSTR("AT+CBAND=\""), &command);
+    NetworkCache_getBand(&command);
+    CharString_appendP(PSTR("\";+COPS=4,2,\""), &command);
+    NetworkCache_getOperator(&command);
+    CharString_appendC('"', &command);
+    sendSIM800CommandCS(&command);
+}
+
+static void beginNetworkSelection (void)
+{
+    SessionJournal_markPhase(sjp_bringup);
+    if (NetworkCache_isValid()) {
+        networkSelection = ns_cached;
+        sendCachedNetworkCommand();
+        SystemTime_futureTime(NETWORK_CACHE_TIMEOUT, &powerupResumeTime);
+        ccState = ccs_waitingForCachedNetworkResponse;
+    } else {
+        networkSelection = ns_automatic;
+        requestRegistrationStatus();
+        ccState = ccs_waitingForCREGResponse;
+    }
+}
+
+static int32_t hundredthsSincePowerup (void)
+{
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    return
+        (SystemTime_diffSec(&curTime, &powerupTime) * 100) +
+        ((int16_t)curTime.hundredths - (int16_t)powerupTime.hundredths);
+}
+
+static void beginRegisteredOperation (void)
+{
+    Console_printP(PSTR("Registered."));
+    SessionJournal_markPhase(sjp_registration);
+    if (registrationTime == 0) {
+        const int32_t hundredths = hundredthsSincePowerup();
+        registrationTime = (hundredths >= 655350L)
+            ? 0xFFFF
+            : ((hundredths / 10) + 1); // never 0 once registered
+    }
+
+#if USE_CMGL
+    SystemTime_futureTime(500, &nextCheckForIncomingSMSMessageTime);
+#endif
+    SystemTime_futureTime(1000, &nextCheckForNetworkTimeAndCSQTime);
+    sendCSQCommand();
+    ccState = ccs_waitingForInitialCSQResponse;
+}
+
+#if CONCATENATED_BRINGUP
+static void buildBringupCommand (
+    CharString_t *command)
+{
+    CharString_copyP(PSTR("ATE0;+CMGF=1;+CIPQSEND="), command);
+    CharString_appendC((SettingsShadow_cipqsend() != 0) ? '1' : '0', command);
+    CharString_appendP(PSTR(";+CIPHEAD=1"), command);
+}
+
+static uint16_t commandCRC (
+    const CharString_t *command)
+{
+    uint16_t crc = 0xFFFF;
+    CharString_Iter iter = CharString_begin(command);
+    const CharString_Iter end = CharString_end(command);
+    while (iter != end) {
+        crc = _crc_ccitt_update(crc, *iter++);
+    }
+    return crc;
+}
+#endif
+
 // power down cellular module
 static void powerDownCellularModule (void)
 {
     SIM800_powerOff();
     cregStatus = 0;
+    signalQualityKnown = false;
     signalQuality = 0;
 }
 
@@ -393,8 +641,15 @@ void CellularComm_Initialize (void)
     SIM800_setCSQCallback(CSQCallback);
     SIM800_setCMTICallback(CMTICallback);
     SIM800_setCPINCallback(CPINCallback);
+    SIM800_setCREGCallback(CREGCallback);
+    SIM800_setCOPSCallback(COPSCallback);
+    SIM800_setCBANDCallback(CBANDCallback);
     SIM800_setCCLKCallback(CCLKCallback);
     SIM800_setCBCCallback(CBCCallback);
+#if CONCATENATED_BRINGUP
+    SIM800_setCIPHEADCallback(CIPHEADCallback);
+    SIM800_setCIPQSENDCallback(CIPQSENDCallback);
+#endif
 
     CellularTCPIP_Initialize();
 
@@ -403,7 +658,7 @@ void CellularComm_Initialize (void)
 
     // set up for outgoing SMS messages
     CharString_clear(&outgoingSMSMessagePhoneNumber);
-    CharString_clear(&outgoingSMSMessageText);
+    endSMSPhase();
 
     ccEnabled = false;
     gotFunctionlevel = false;
@@ -411,6 +666,7 @@ void CellularComm_Initialize (void)
     gotNetworkTime = false;
     cregStatus = 0;
     gotSignalQuality = false;
+    signalQualityKnown = false;
     signalQuality = 0;
     ccState = ccs_initial;
     SystemTime_futureTime(STATE_TIMEOUT_TIME, &stateTimeoutTime);
@@ -419,26 +675,57 @@ void CellularComm_Initialize (void)
     batteryChargeStatus = 0;
     batteryPercent = 0;
     batteryMillivolts = 0;
+
+#if USE_MODEM_SLEEP
+    sleepRequested = false;
+    if (modemAsleep) {
+        // the module was left asleep while we slept. it is still powered,
+        // registered and holding its PDP context
+        SIM800_assumePowerState(true);
+        ccState = ccs_sleeping;
+    }
+#endif
 }
 
 void CellularComm_Enable (void)
 {
     ccEnabled = true;
+#if USE_MODEM_SLEEP
+    sleepRequested = false;
+#endif
 }
 
 void CellularComm_Disable (void)
 {
     ccEnabled = false;
+#if USE_MODEM_SLEEP
+    sleepRequested = false;
+#endif
+}
+
+void CellularComm_Sleep (void)
+{
+    ccEnabled = false;
+#if USE_MODEM_SLEEP
+    sleepRequested = true;
+#endif
 }
 
 void CellularComm_task (void)
 {
     // state timeout logic. reboots if stuck in a state
-    if ((ccState == prevCcState) && (ccState != ccs_disabled)) {
+    if ((ccState == prevCcState) &&
+        (ccState != ccs_disabled) &&
+        (ccState != ccs_sleeping)) {
         if ((!SystemTime_shuttingDown()) &&
             (SystemTime_timeHasArrived(&stateTimeoutTime))) {
             Console_printP(PSTR("!! Timeout !!"));
             EEPROMStorage_setTimeoutState((int)ccState);
+#if CONCATENATED_BRINGUP
+            // the module may not be in the state its saved profile
+            // says it is. configure it from scratch after the reboot
+            EEPROM_writeWord(&savedModemProfile, NO_MODEM_PROFILE);
+#endif
             SystemTime_commenceShutdown();
         }
     } else {
@@ -446,12 +733,29 @@ void CellularComm_task (void)
         prevCcState = ccState;
     }
 
+#if USE_MODEM_SLEEP
+    if (measuringColdStart &&
+        (CellularTCPIP_connectionStatus() == cs_connected)) {
+        measuringColdStart = false;
+        const int32_t tenths = hundredthsSincePowerup() / 10;
+        coldStartTime = (tenths > 65535L)
+            ? 0xFFFF
+            : (uint16_t)tenths;
+    }
+#endif
+
     switch (ccState) {
         case ccs_initial :
             if (ccEnabled) {
                 if (SIM800_status() == SIM800_ms_off) {
                     Console_printP(PSTR("> Enabling Cell <"));
                     SIM800_powerOn();
+                    SystemTime_getCurrentTime(&powerupTime);
+                    registrationTime = 0;
+                    SessionJournal_beginSession();
+#if USE_MODEM_SLEEP
+                    measuringColdStart = true;
+#endif
                     ccState = ccs_waitingForOnkeyResponse;
                 } else {
                     // already on
@@ -465,6 +769,17 @@ void CellularComm_task (void)
             // wait until tcpip disconnects
             CellularTCPIP_Subtask();
             if (CellularTCPIP_connectionStatus() == cs_disconnected) {
+#if USE_MODEM_SLEEP
+                measuringColdStart = false;
+                if (sleepRequested) {
+                    // CIPCLOSE left the PDP context up, so the next
+                    // connection after waking only needs a CIPSTART.
+                    // the module sleeps whenever its serial port is idle
+                    sendSIM800CommandP(PSTR("AT+CSCLK=2"));
+                    ccState = ccs_waitingForSleepResponse;
+                    break;
+                }
+#endif
                 powerDownCellularModule();
                 ccState = ccs_waitingForSIM800PowerDown;
             }
@@ -500,7 +815,8 @@ void CellularComm_task (void)
                         sendCMGSCommand(&outgoingSMSMessagePhoneNumber);
                         CharString_clear(&outgoingSMSMessagePhoneNumber);
                         ccState = ccs_waitingForCMGSPrompt;
-                    } else if (!MessageIDQueue_isEmpty(&incomingSMSMessageIDs)) {
+                    } else if (!MessageIDQueue_isEmpty(&incomingSMSMessageIDs) &&
+                        beginSMSPhase()) {
                         // we have an incoming message ID
                         currentlyProcessingMessageID =
                             MessageIDQueue_remove(&incomingSMSMessageIDs);
@@ -530,11 +846,15 @@ void CellularComm_task (void)
                         ccState = ccs_waitingForCCLKResponse;
                     }
                 } else {
-                    CellularComm_requestRegistrationStatus();
+                    requestRegistrationStatus();
                     ccState = ccs_waitingForCREGResponse;
                 }
             } else {
                 // cellular com is disabled. enter disabled state
+                // drop any unsent reply so that the TCPIP subtask
+                // has scratch room while disconnecting
+                CharString_clear(&outgoingSMSMessagePhoneNumber);
+                endSMSPhase();
                 TCPIPConsole_disable(false);
                 CellularTCPIP_disconnect();
                 ccState = ccs_disabling;
@@ -545,10 +865,19 @@ void CellularComm_task (void)
         case ccs_waitingForOnkeyResponse : {
             if (SIM800_status() == SIM800_ms_readyForCommand) {
                 Console_printP(PSTR("> Cell Ready <"));
+                SessionJournal_markPhase(sjp_powerOn);
 
+#if CONCATENATED_BRINGUP
+                // echo is turned off along with the rest of the
+                // configuration once the SIM is ready
+                gotCPIN = false;
+                ccState = ccs_waitingForCPINQueryResponse;
+                needToEnterPIN = false;
+#else
                 // turn echo off
                 sendSIM800CommandP(PSTR("ATE0"));
                 ccState = ccs_waitingForEchoOffResponse;
+#endif
             }
             }
             break;
@@ -569,9 +898,25 @@ void CellularComm_task (void)
             if (gotCPIN) {
                 Console_printP(PSTR("PIN ready."));
 
+#if CONCATENATED_BRINGUP
+                CharString_define(40, bringup);
+                buildBringupCommand(&bringup);
+                modemProfile = commandCRC(&bringup);
+                if (modemProfile == EEPROM_readWord(&savedModemProfile)) {
+                    // check that the module came up with this configuration
+                    moduleCIPHEAD = SETTING_NOT_REPORTED;
+                    moduleCIPQSEND = SETTING_NOT_REPORTED;
+                    sendSIM800CommandP(PSTR("AT+CIPHEAD?;+CIPQSEND?"));
+                    ccState = ccs_waitingForProfileCheckResponse;
+                } else {
+                    sendSIM800CommandCS(&bringup);
+                    ccState = ccs_waitingForBringupResponse;
+                }
+#else
                 // set SMS to text mode
                 sendSIM800CommandP(PSTR("AT+CMGF=1"));
                 ccState = ccs_waitingForCMGFResponse;
+#endif
             }
             }
             break;
@@ -580,7 +925,7 @@ void CellularComm_task (void)
                 // enable or disable quick send
                 CharString_define(16, cipqsend);
                 CharString_copyP(PSTR("AT+CIPQSEND="), &cipqsend);
-                CharString_appendC((EEPROMStorage_cipqsend() != 0) ? '1' : '0', &cipqsend);
+                CharString_appendC((SettingsShadow_cipqsend() != 0) ? '1' : '0', &cipqsend);
                 sendSIM800CommandCS(&cipqsend);
                 ccState = ccs_waitingForCIPQSENDResponse;
             }
@@ -599,26 +944,73 @@ void CellularComm_task (void)
             }
         case ccs_waitingForInitialCBCResponse :
             if (SIM800ResponseMsg == rm_OK) {
-                CellularComm_requestRegistrationStatus();
+                beginNetworkSelection();
+            }
+            break;
+        case ccs_waitingForCachedNetworkResponse :
+            if (SIM800ResponseMsg == rm_OK) {
+                requestRegistrationStatus();
+                ccState = ccs_waitingForCREGResponse;
+            } else if ((SIM800ResponseMsg == rm_ERROR) ||
+                       SystemTime_timeHasArrived(&powerupResumeTime)) {
+                Console_printP(PSTR("cached network failed"));
+                NetworkCache_invalidate();
+                networkSelection = ns_cacheFailed;
+                sendSIM800CommandP(PSTR("AT+COPS=0"));
+                ccState = ccs_waitingForAutomaticNetworkResponse;
+            }
+            break;
+        case ccs_waitingForAutomaticNetworkResponse :
+            if ((SIM800ResponseMsg == rm_OK) ||
+                (SIM800ResponseMsg == rm_ERROR)) {
+                requestRegistrationStatus();
                 ccState = ccs_waitingForCREGResponse;
             }
             break;
+#if CONCATENATED_BRINGUP
+        case ccs_waitingForBringupResponse :
+            if (SIM800ResponseMsg == rm_OK) {
+                // save the configuration so that the module powers up
+                // with it next time
+                sendSIM800CommandP(PSTR("AT&W"));
+                ccState = ccs_waitingForProfileSaveResponse;
+            }
+            break;
+        case ccs_waitingForProfileSaveResponse :
+            if (SIM800ResponseMsg == rm_OK) {
+                EEPROM_writeWord(&savedModemProfile, modemProfile);
+                sendCBCCommand();
+                ccState = ccs_waitingForInitialCBCResponse;
+            }
+            break;
+        case ccs_waitingForProfileCheckResponse :
+            if ((SIM800ResponseMsg == rm_OK) &&
+                (moduleCIPHEAD == 1) &&
+                (moduleCIPQSEND == ((SettingsShadow_cipqsend() != 0) ? 1 : 0))) {
+                sendCBCCommand();
+                ccState = ccs_waitingForInitialCBCResponse;
+            } else if ((SIM800ResponseMsg == rm_OK) ||
+                       (SIM800ResponseMsg == rm_ERROR)) {
+                // the module isn't configured the way its saved profile
+                // says it is. configure it and save the profile again
+                Console_printP(PSTR("modem profile lost"));
+                EEPROM_writeWord(&savedModemProfile, NO_MODEM_PROFILE);
+                CharString_define(40, bringup);
+                buildBringupCommand(&bringup);
+                sendSIM800CommandCS(&bringup);
+                ccState = ccs_waitingForBringupResponse;
+            }
+            break;
+#endif
         case ccs_waitingForCREGResponse : {
-            if (CellularComm_gotRegistrationStatus()) {
+            if (gotRegistrationStatus()) {
                 if (CellularComm_isRegistered()) {
-                    Console_printP(PSTR("Registered."));
-
-#if USE_CMGL
-                    SystemTime_futureTime(500, &nextCheckForIncomingSMSMessageTime);
-#endif
-                    SystemTime_futureTime(1000, &nextCheckForNetworkTimeAndCSQTime);
-                    sendCSQCommand();
-                    ccState = ccs_waitingForInitialCSQResponse;
+                    beginRegisteredOperation();
                 } else {
                     // not registered yet.
                     if (ccEnabled) {
                         ccState = ccs_waitToRecheckCREG;
-                        SystemTime_futureTime(200, &powerupResumeTime);
+                        SystemTime_futureTime(CREG_RECHECK_TIME, &powerupResumeTime);
                     } else {
                         ccState = ccs_idle;
                     }
@@ -627,14 +1019,29 @@ void CellularComm_task (void)
             }
             break;
         case ccs_waitToRecheckCREG : {
-            if (SystemTime_timeHasArrived(&powerupResumeTime)) {
-                CellularComm_requestRegistrationStatus();
+            if (CellularComm_isRegistered()) {
+                // the module reported that it has registered
+                beginRegisteredOperation();
+            } else if (!ccEnabled) {
+                ccState = ccs_idle;
+            } else if (SystemTime_timeHasArrived(&powerupResumeTime)) {
+                requestRegistrationStatus();
                 ccState = ccs_waitingForCREGResponse;
             }
             }
             break;
         case ccs_waitingForInitialCSQResponse :
             if (SIM800ResponseMsg == rm_OK) {
+                // find out which network we registered on, to cache it.
+                // the operator is asked for in numeric format
+                CharString_clear(&networkOperator);
+                sendSIM800CommandP(PSTR("AT+COPS=3,2;+COPS?;+CBAND?"));
+                ccState = ccs_waitingForNetworkQueryResponse;
+            }
+            break;
+        case ccs_waitingForNetworkQueryResponse :
+            if ((SIM800ResponseMsg == rm_OK) ||
+                (SIM800ResponseMsg == rm_ERROR)) {
                 ccState = ccs_idle;
             }
             break;
@@ -693,7 +1100,9 @@ void CellularComm_task (void)
                         CharStringSpan_t cmd;
                         CharStringSpan_initRight(&incomingSMSMessageText,
                             strlen_P(smsCommandPrefix), &cmd);
-                        if (CommandProcessor_executeCommand(&cmd, &outgoingSMSMessageText)) {
+                        ReplyWriter_t reply;
+                        ReplyWriter_initForString(&outgoingSMSMessageText, &reply);
+                        if (CommandProcessor_executeCommand(&cmd, &reply)) {
                             // valid command
                             if (!CharString_isEmpty(&outgoingSMSMessageText)) {
                                 // a reply was generated from the command
@@ -707,6 +1116,10 @@ void CellularComm_task (void)
                         }
                     }
                 }
+                if (CharString_isEmpty(&outgoingSMSMessagePhoneNumber)) {
+                    // no reply to send
+                    endSMSPhase();
+                }
                 ccState = ccs_idle;
             }
             }
@@ -715,7 +1128,8 @@ void CellularComm_task (void)
             if (gotSIM800Prompt) {
                 Console_printP(PSTR("sending SMS"));
                 SIM800_sendStringCS(&outgoingSMSMessageText);
-                CharString_clear(&outgoingSMSMessageText);
+                // the text has been handed to the SIM800 output queue
+                endSMSPhase();
                 SIM800_sendCtrlZ();
                 ccState = ccs_waitingForCMGSResponse;
             }
@@ -764,6 +1178,60 @@ void CellularComm_task (void)
             }
             }
             break;
+#if USE_MODEM_SLEEP
+        case ccs_waitingForSleepResponse :
+            if (SIM800ResponseMsg == rm_OK) {
+                Console_printP(PSTR("> Cell Sleeping <"));
+                modemAsleep = true;
+                ccState = ccs_sleeping;
+            } else if (SIM800ResponseMsg == rm_ERROR) {
+                powerDownCellularModule();
+                ccState = ccs_waitingForSIM800PowerDown;
+            }
+            break;
+        case ccs_sleeping :
+            if (ccEnabled) {
+                Console_printP(PSTR("> Waking Cell <"));
+                SessionJournal_beginSession();
+                wakeAttempts = 1;
+                sendSIM800CommandP(PSTR("AT"));
+                SystemTime_futureTime(MODEM_WAKE_RETRY_TIME, &powerupResumeTime);
+                ccState = ccs_waitingForWakeResponse;
+            }
+            break;
+        case ccs_waitingForWakeResponse :
+            if (SIM800ResponseMsg == rm_OK) {
+                sendSIM800CommandP(PSTR("AT+CSCLK=0"));
+                ccState = ccs_waitingForSleepDisableResponse;
+            } else if (SystemTime_timeHasArrived(&powerupResumeTime)) {
+                if (wakeAttempts < MODEM_WAKE_ATTEMPTS) {
+                    ++wakeAttempts;
+                    sendSIM800CommandP(PSTR("AT"));
+                    SystemTime_futureTime(MODEM_WAKE_RETRY_TIME, &powerupResumeTime);
+                } else {
+                    // the module isn't answering (it may have lost power).
+                    // start it from cold
+                    Console_printP(PSTR("Cell didn't wake"));
+                    modemAsleep = false;
+                    SIM800_assumePowerState(false);
+                    ccState = ccs_initial;
+                }
+            }
+            break;
+        case ccs_waitingForSleepDisableResponse :
+            if (SIM800ResponseMsg == rm_OK) {
+                Console_printP(PSTR("> Cell Awake <"));
+                SessionJournal_markPhase(sjp_powerOn);
+                SessionJournal_markPhase(sjp_bringup);
+                modemAsleep = false;
+                // registration time is measured from waking
+                SystemTime_getCurrentTime(&powerupTime);
+                registrationTime = 0;
+                requestRegistrationStatus();
+                ccState = ccs_waitingForCREGResponse;
+            }
+            break;
+#endif
         default:
             // unexpected state
             // trigger system reset here
@@ -774,27 +1242,47 @@ void CellularComm_task (void)
 
 bool CellularComm_isEnabled (void)
 {
-    return (ccState != ccs_disabled);
+    return (ccState != ccs_disabled) && (ccState != ccs_sleeping);
 }
 
-bool CellularComm_isIdle (void)
+bool CellularComm_isSleeping (void)
 {
-    return ((ccState == ccs_disabled) || (ccState == ccs_idle)) &&
-        CharString_isEmpty(&outgoingSMSMessagePhoneNumber) &&
-        MessageIDQueue_isEmpty(&incomingSMSMessageIDs) &&
-        (!CellularTCPIP_hasSubtaskWorkToDo());
+#if USE_MODEM_SLEEP
+    return modemAsleep;
+#else
+    return false;
+#endif
 }
 
-void CellularComm_requestRegistrationStatus (void)
+bool CellularComm_sleepIsCheaper (
+    const uint32_t gapSeconds)
 {
-    SIM800_setCREGCallback(CREGCallback);
-    gotCREG = false;
-    sendSIM800CommandP(PSTR("AT+CREG?"));
+#if USE_MODEM_SLEEP
+    if (!CellularComm_isRegistered()) {
+        // the session didn't go well. start the next one from cold
+        return false;
+    }
+
+    // charge in milliamp tenths of a second
+    const uint32_t sleepCharge =
+        (MODEM_SLEEP_CURRENT * (gapSeconds * 10)) +
+        (MODEM_ACTIVE_CURRENT * (MODEM_WAKE_TIME * 10));
+    const uint32_t coldStartCharge =
+        MODEM_ACTIVE_CURRENT * (uint32_t)coldStartTime;
+    return sleepCharge < coldStartCharge;
+#else
+    return false;
+#endif
 }
 
-bool CellularComm_gotRegistrationStatus (void)
+bool CellularComm_isIdle (void)
 {
-    return (gotCREG && (SIM800ResponseMsg == rm_OK));
+    return ((ccState == ccs_disabled) ||
+            (ccState == ccs_sleeping) ||
+            (ccState == ccs_idle)) &&
+        CharString_isEmpty(&outgoingSMSMessagePhoneNumber) &&
+        MessageIDQueue_isEmpty(&incomingSMSMessageIDs) &&
+        (!CellularTCPIP_hasSubtaskWorkToDo());
 }
 
 uint8_t CellularComm_registrationStatus (void)
@@ -819,6 +1307,11 @@ uint8_t CellularComm_SignalQuality (void)
     return signalQuality;
 }
 
+bool CellularComm_haveSignalQuality (void)
+{
+    return signalQualityKnown;
+}
+
 int CellularComm_state (void)
 {
     return (int)ccState;
@@ -835,6 +1328,16 @@ uint16_t CellularComm_batteryMillivolts (void)
     return batteryMillivolts;
 }
 
+uint16_t CellularComm_registrationTime (void)
+{
+    return registrationTime;
+}
+
+CellularComm_NetworkSelection CellularComm_networkSelection (void)
+{
+    return networkSelection;
+}
+
 uint8_t CellularComm_batteryPercent (void)
 {
     return batteryPercent;
@@ -11,25 +11,49 @@
 #include "CharStringSpan.h"
 #include "SIM800.h"
 
+// how the network that the cell module registered on was chosen
+typedef enum CellularComm_NetworkSelection_enum {
+    ns_automatic,   // nothing cached. the module scanned for a network
+    ns_cached,      // the module was asked for the cached network first
+    ns_cacheFailed  // the cached network was refused or took too long,
+                    // so the module fell back to automatic selection
+} CellularComm_NetworkSelection;
+
 extern void CellularComm_Initialize (void);
 
 // called by cell enable/disable commands
 extern void CellularComm_Enable (void);
 extern void CellularComm_Disable (void);
+// like CellularComm_Disable, but leaves the cell module asleep and
+// registered instead of powering it down
+extern void CellularComm_Sleep (void);
 
 // called by mainloop task "scheduler"
 extern void CellularComm_task (void);
 
 extern bool CellularComm_isEnabled (void);
 extern bool CellularComm_isIdle (void);
+// true while the cell module is asleep. its power has to be left on
+extern bool CellularComm_isSleeping (void);
+// true if leaving the cell module asleep for the given number of seconds
+// takes less energy than powering it down and cold starting it again
+extern bool CellularComm_sleepIsCheaper (
+    const uint32_t gapSeconds);
 
-extern void CellularComm_requestRegistrationStatus (void);
-extern bool CellularComm_gotRegistrationStatus (void);
+// registration status is kept up to date by unsolicited reports from
+// the cell module once it has been powered up
 extern uint8_t CellularComm_registrationStatus (void);
 extern bool CellularComm_isRegistered (void);
+// time from powering up the cell module until it first registered, in
+// tenths of a second. 0 if it hasn't registered since power up
+extern uint16_t CellularComm_registrationTime (void);
+extern CellularComm_NetworkSelection CellularComm_networkSelection (void);
 
 extern const SIM800_NetworkTime* CellularComm_currentTime (void);
 extern uint8_t CellularComm_SignalQuality (void);
+// false until the module has reported the signal quality since it was
+// powered up or woken
+extern bool CellularComm_haveSignalQuality (void);
 extern int CellularComm_state (void);
 extern bool CellularComm_stateIsTCPIPSubtask(const int state);
 extern uint16_t CellularComm_batteryMillivolts (void);
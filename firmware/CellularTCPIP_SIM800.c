@@ -13,13 +13,17 @@
 #include "CellularComm_SIM800.h"
 #include "EEPROMStorage.h"
 #include "Console.h"
+#include "ScratchArena.h"
+#include "DNSCache.h"
+#include "SessionJournal.h"
+#include "ATLatency.h"
 
 #define CIPACK_BEFORE_CIPSEND 1
 #define DEBUG_TRACE 0
 
 // time parameters (in seconds)
 #define IPSTATE_REQUEST_DELAY 100
-#define CREG_TIMEOUT 500
+#define CDNSGIP_TIMEOUT 1500
 #define CIPSTART_TIMEOUT 1500
 #define SEND_TIMEOUT 1500
 
@@ -34,11 +38,11 @@ typedef enum CellularTCPIPCommand_enum {
 // states
 typedef enum CellularTCPIPState_enum {
     cts_idle,
-    cts_waitingForCREGResponse,
     cts_waitingForCGATTResponse,
     cts_waitingForCSTTResponse,
     cts_waitingForCIICRResponse,
     cts_waitingForCIFSRResponse,
+    cts_waitingForCDNSGIPResult,
     cts_waitingForCIPSTARTResponse,
     cts_waitingForCIPACKResponse,
     cts_waitingForCIPSENDPrompt,
@@ -67,6 +71,9 @@ static bool gprsIsAttached;
 static bool gotIPAddress;
 static bool gotPrompt;
 static bool gotDataAccept;
+static bool gotDNSResult;
+static bool connectingToCachedAddress;
+static SIM800_IPDataCallback ctDataReceiver;
 
 void responseMessageCallback (
     const SIM800_ResponseMessage msg)
@@ -84,6 +91,7 @@ static void sendSIM800CommandP (
     SIM800_setResponseMessageCallback(responseMessageCallback);
     SIM800ResponseMsg = rm_noResponseYet;
     ctState = responseWaitState;
+    ATLatency_commandSentP(command);
     SIM800_sendLineP(command);
 }
 
@@ -94,6 +102,7 @@ static void sendSIM800CommandCS (
     SIM800_setResponseMessageCallback(responseMessageCallback);
     SIM800ResponseMsg = rm_noResponseYet;
     ctState = responseWaitState;
+    ATLatency_commandSentCS(command);
     SIM800_sendLineCS(command);
 }
 
@@ -125,18 +134,54 @@ static void endSubtask (
     resetSubtask();
 }
 
+// connects to the cached address of the host if there is one, otherwise
+// has the cell module look up the host name
 static void sendCIPSTART (
     CharString_t *cmdBuffer)
 {
     CharString_copyP(PSTR("AT+CIPSTART=\"TCP\",\""), cmdBuffer);
-    CharString_appendCS(&ctHostAddress, cmdBuffer);
+    connectingToCachedAddress = DNSCache_lookup(&ctHostAddress, cmdBuffer);
+    if (!connectingToCachedAddress) {
+        CharString_appendCS(&ctHostAddress, cmdBuffer);
+    }
     CharString_appendP(PSTR("\",\""), cmdBuffer);
     StringUtils_appendDecimal(ctHostPort, 1, 0, cmdBuffer);
     CharString_appendP(PSTR("\""), cmdBuffer);
     SystemTime_futureTime(CIPSTART_TIMEOUT, &ctResponseTimeoutTime);
+    SessionJournal_markPhase(sjp_attach);
     sendSIM800CommandCS(cmdBuffer, cts_waitingForCIPSTARTResponse);
 }
 
+static void CDNSGIPCallback (
+    const bool resolved,
+    const CharStringSpan_t *address)
+{
+    if (resolved) {
+        DNSCache_store(&ctHostAddress, address);
+    }
+    gotDNSResult = true;
+}
+
+// resolves the host name unless it is an address or its address is
+// cached, and then starts the connection
+static void startConnection (
+    CharString_t *cmdBuffer)
+{
+    CharString_clear(cmdBuffer);
+    if (DNSCache_isAddress(&ctHostAddress) ||
+        DNSCache_lookup(&ctHostAddress, cmdBuffer)) {
+        sendCIPSTART(cmdBuffer);
+    } else {
+        gotDNSResult = false;
+        SIM800_setCDNSGIPCallback(CDNSGIPCallback);
+        CharString_copyP(PSTR("AT+CDNSGIP=\""), cmdBuffer);
+        CharString_appendCS(&ctHostAddress, cmdBuffer);
+        CharString_appendC('"', cmdBuffer);
+        SystemTime_futureTime(CDNSGIP_TIMEOUT, &ctResponseTimeoutTime);
+        sendSIM800CommandCS(cmdBuffer, cts_waitingForCDNSGIPResult);
+    }
+}
+
 static void CGATTCallback (
     const bool gprsAttached)
 {
@@ -252,7 +297,7 @@ static void advanceStateForConnect (
         case ips_IP_STATUS :
         case ips_TCP_CLOSED :
         case ips_UDP_CLOSED :
-            sendCIPSTART(cmdBuffer);
+            startConnection(cmdBuffer);
             break;
         default:
             // not expected to ever get here
@@ -380,6 +425,16 @@ CellularTCPIPConnectionStatus CellularTCPIP_connectionStatus (void)
     return curConnectionStatus;
 }
 
+// counts data from the host for the session journal and passes it on
+static void receivedIPData (
+    const CharString_t *ipData)
+{
+    SessionJournal_countReceived(CharString_length(ipData));
+    if (ctDataReceiver != 0) {
+        ctDataReceiver(ipData);
+    }
+}
+
 void CellularTCPIP_connect (
     const CharString_t *hostAddress,
     const uint16_t hostPort,
@@ -388,7 +443,8 @@ void CellularTCPIP_connect (
 {
     CharString_copyCS(hostAddress, &ctHostAddress);
     ctHostPort = hostPort;
-    SIM800_setIPDataCallback(receiver);
+    ctDataReceiver = receiver;
+    SIM800_setIPDataCallback(receivedIPData);
     connStateChangeCallback = stateChangeCallback;
     curCommand = c_connect;
 }
@@ -424,7 +480,6 @@ bool CellularTCPIP_hasSubtaskWorkToDo (void)
 
 void CellularTCPIP_Subtask (void)
 {
-    CharString_define(70, cmdBuffer);// define here to keep stack frame small
     switch (ctState) {
         case cts_idle :
             switch (curConnectionStatus) {
@@ -452,10 +507,16 @@ void CellularTCPIP_Subtask (void)
 #endif
                         setConnectionStatus(cs_connecting);
 
-                        // begin by checking registration
-                        CellularComm_requestRegistrationStatus();
-                        SystemTime_futureTime(CREG_TIMEOUT, &ctResponseTimeoutTime);
-                        ctState = cts_waitingForCREGResponse;
+                        // begin by checking registration. CellularComm
+                        // tracks it from the module's unsolicited reports
+                        if (CellularComm_isRegistered()) {
+                            requestCGATTStatus();
+                        } else {
+                            Console_printP(PSTR("not registered"));
+                            CharString_clear(&ctHostAddress);
+
+                            endSubtask(cs_disconnected);
+                        }
                     }
                     break;
                 default :
@@ -467,21 +528,6 @@ void CellularTCPIP_Subtask (void)
                     break;
             }
             break;
-        case cts_waitingForCREGResponse :
-            if (SystemTime_timeHasArrived(&ctResponseTimeoutTime)) {
-                endSubtask(cs_disconnected);
-            } else if (CellularComm_gotRegistrationStatus()) {
-                if (CellularComm_isRegistered()) {
-                    // registered
-                    requestCGATTStatus();
-                } else {
-                    Console_printP(PSTR("not registered"));
-                    CharString_clear(&ctHostAddress);
-
-                    endSubtask(cs_disconnected);
-                }
-            }
-            break;
         case cts_waitingForCGATTResponse :
             if (SIM800ResponseMsg == rm_OK) {
                 if (gprsIsAttached) {
@@ -517,16 +563,37 @@ void CellularTCPIP_Subtask (void)
                 endSubtask(cs_disconnected);
             }
             break;
+        case cts_waitingForCDNSGIPResult :
+            // if the name wasn't resolved, CIPSTART is given the name
+            // and the cell module looks it up itself
+            if (gotDNSResult ||
+                (SIM800ResponseMsg == rm_ERROR) ||
+                SystemTime_timeHasArrived(&ctResponseTimeoutTime)) {
+                CharString_t cmdBuffer;
+                if (ScratchArena_allocString(70, &cmdBuffer)) {
+                    sendCIPSTART(&cmdBuffer);
+                }
+            }
+            break;
         case cts_waitingForCIPSTARTResponse :
             if (SystemTime_timeHasArrived(&ctResponseTimeoutTime)) {
+                if (connectingToCachedAddress) {
+                    DNSCache_invalidate();
+                }
                 endSubtask(cs_disconnected);
             } else {
                 switch (SIM800ResponseMsg) {
                     case rm_CONNECT_OK :
+                        SessionJournal_markPhase(sjp_connect);
                         endSubtask(cs_connected);
                         break;
                     case rm_ERROR :
                     case rm_CONNECT_FAIL :
+                        // the host may have moved. look it up again
+                        // next time
+                        if (connectingToCachedAddress) {
+                            DNSCache_invalidate();
+                        }
                         endSubtask(cs_disconnected);
                         break;
                     default:
@@ -608,8 +675,12 @@ void CellularTCPIP_Subtask (void)
             break;
         case cts_waitingForIPState :
             if (curIPState != ips_unknown) {
-                // we got a state
-                advanceStateForCommand(&cmdBuffer);
+                // we got a state. if there is no scratch room for
+                // the command we try again on the next call
+                CharString_t cmdBuffer;
+                if (ScratchArena_allocString(70, &cmdBuffer)) {
+                    advanceStateForCommand(&cmdBuffer);
+                }
             } else if ((SIM800ResponseMsg == rm_ERROR)  ||
                        (SIM800ResponseMsg == rm_CLOSED)) {
                 endSubtask(cs_disconnected);
@@ -642,17 +713,20 @@ uint16_t CellularTCPIP_availableSpaceForWriteData (void)
 void CellularTCPIP_writeDataP (
     PGM_P data)
 {
+    SessionJournal_countSent(strlen_P(data));
     SIM800_sendStringP(data);
 }
 
 void CellularTCPIP_writeDataCS (
-    CharString_t *data)
+    const CharString_t *data)
 {
+    SessionJournal_countSent(CharString_length(data));
     SIM800_sendStringCS(data);
 }
 
 void CellularTCPIP_writeDataCSS (
-    CharStringSpan_t *data)
+    const CharStringSpan_t *data)
 {
+    SessionJournal_countSent(CharStringSpan_length(data));
     SIM800_sendStringCSS(data);
 }
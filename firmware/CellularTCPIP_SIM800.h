@@ -60,8 +60,8 @@ extern uint16_t CellularTCPIP_availableSpaceForWriteData (void);
 extern void CellularTCPIP_writeDataP (
     PGM_P data);
 extern void CellularTCPIP_writeDataCS (
-    CharString_t *data);
+    const CharString_t *data);
 extern void CellularTCPIP_writeDataCSS (
-    CharStringSpan_t *data);
+    const CharStringSpan_t *data);
 
 #endif  // CELLULARTCPIP_H
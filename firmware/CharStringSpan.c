@@ -82,20 +82,26 @@ bool CharStringSpan_equalsNocaseP (
         (strncasecmp_P(leftSpan->m_begin, rightStr, leftLen) == 0);
 }
 
-int CharStringSpan_compareP (
+typedef int (*CompareFunction)(
+    const char *s1,
+    PGM_P s2,
+    size_t n);
+
+static int compareSpan (
     const CharStringSpan_t* leftSpan,
-    PGM_P rightStr)
+    PGM_P rightStr,
+    CompareFunction compare)
 {
     const int leftLen = CharStringSpan_length(leftSpan);
     const int rightLen = strlen_P(rightStr);
     if (leftLen == rightLen) {
-        return strncmp_P(leftSpan->m_begin, rightStr, leftLen);
+        return compare(leftSpan->m_begin, rightStr, leftLen);
     } else {
         const int minLen =
             (leftLen < rightLen)
             ? leftLen
             : rightLen;
-        int comp = strncmp_P(leftSpan->m_begin, rightStr, minLen);
+        int comp = compare(leftSpan->m_begin, rightStr, minLen);
         if (comp == 0) {
             return
                 (leftLen < rightLen)
@@ -107,4 +113,18 @@ int CharStringSpan_compareP (
     }
 }
 
+int CharStringSpan_compareP (
+    const CharStringSpan_t* leftSpan,
+    PGM_P rightStr)
+{
+    return compareSpan(leftSpan, rightStr, strncmp_P);
+}
+
+int CharStringSpan_compareNocaseP (
+    const CharStringSpan_t* leftSpan,
+    PGM_P rightStr)
+{
+    return compareSpan(leftSpan, rightStr, strncasecmp_P);
+}
+
 
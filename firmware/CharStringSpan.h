@@ -110,4 +110,9 @@ extern int CharStringSpan_compareP (
     const CharStringSpan_t* leftSpan,
     PGM_P rightStr);
 
+// same as CharStringSpan_compareP, but ignores case
+extern int CharStringSpan_compareNocaseP (
+    const CharStringSpan_t* leftSpan,
+    PGM_P rightStr);
+
 #endif  // CHARSTRINGSPAN_H
\ No newline at end of file
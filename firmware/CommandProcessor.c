@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <avr/pgmspace.h>
 #include <avr/power.h>
+#include <util/crc16.h>
 
 #include "ADCManager.h"
 #include "SoftwareSerialRx0.h"
@@ -26,14 +27,18 @@
 #include "Console.h"
 #include "EEPROM_Util.h"
 #include "EEPROMStorage.h"
+#include "SettingsShadow.h"
+#include "RAMSentinel.h"
+#include "SessionJournal.h"
+#include "ATLatency.h"
 #include "StringUtils.h"
 #include "UART_async.h"
 
-typedef void (*StringProvider)(
-    CharString_t *string);
+// enable/disable the eedump and eeload commands. They don't fit in flash
+// along with everything else, so they're left out of normal builds
+#define EEPROM_SNAPSHOTS_ENABLED 0
 
 CharString_define(80, CommandProcessor_incomingCommand)
-CharString_define(100, CommandProcessor_commandReply)
 
 // command keywords
 static char pinP[]              PROGMEM = "PIN";
@@ -57,39 +62,90 @@ static char rebootP[]           PROGMEM = "reboot";
 static char sampleIntervalP[]   PROGMEM = "sampleInterval";
 static char logIntervalP[]      PROGMEM = "logInterval";
 static char thingspeakP[]       PROGMEM = "thingspeak";
+static char distanceP[]         PROGMEM = "distance";
+static char timeP[]             PROGMEM = "time";
+static char addressP[]          PROGMEM = "address";
+static char portP[]             PROGMEM = "port";
+static char writekeyP[]         PROGMEM = "writekey";
+static char ackP[]              PROGMEM = "ack";
+#if BYTEQUEUE_HIGHWATERMARK_ENABLED
+static char bqhwP[]             PROGMEM = "bqhw";
+#endif
+#if EEPROM_SNAPSHOTS_ENABLED
+static char eedumpP[]           PROGMEM = "eedump";
+static char eeloadP[]           PROGMEM = "eeload";
+#endif
+static char eereadP[]           PROGMEM = "eeread";
+static char eewriteP[]          PROGMEM = "eewrite";
+static char extendP[]           PROGMEM = "extend";
+static char getP[]              PROGMEM = "get";
+#if SESSIONJOURNAL_ENABLED
+static char journalP[]          PROGMEM = "journal";
+#endif
+#if ATLATENCY_ENABLED
+static char latencyP[]          PROGMEM = "latency";
+#endif
+static char setP[]              PROGMEM = "set";
+static char smsP[]              PROGMEM = "sms";
+static char statusP[]           PROGMEM = "status";
+static char tsetP[]             PROGMEM = "tset";
 
-void CommandProcessor_createStatusMessage (
-    CharString_t *msg)
+static void writeTime (
+    const SystemTime_t *time,
+    ReplyWriter_t *reply)
+{
+    CharString_define(16, timeStr);
+    SystemTime_appendToString(time, &timeStr);
+    ReplyWriter_writeCS(&timeStr, reply);
+}
+
+void CommandProcessor_writeStatusMessage (
+    ReplyWriter_t *msg)
 {
-    CharString_clear(msg);
     SystemTime_t curTime;
     SystemTime_getCurrentTime(&curTime);
-    SystemTime_appendToString(&curTime, msg);
-    CharString_appendP(PSTR(",st:"), msg);
-    StringUtils_appendDecimal(CellularComm_state(), 2, 0, msg);
+    writeTime(&curTime, msg);
+    ReplyWriter_writeP(PSTR(",st:"), msg);
+    ReplyWriter_writeDecimal(CellularComm_state(), 2, 0, msg);
     if (CellularComm_stateIsTCPIPSubtask(CellularComm_state())) {
-        CharString_appendC('.', msg);
-        StringUtils_appendDecimal(CellularTCPIP_state(), 2, 0, msg);
-    }
-    CharString_appendP(PSTR(","), msg);
-    StringUtils_appendDecimal(WaterLevelMonitor_state(), 1, 0, msg);
-    CharString_appendP(PSTR(",U:"), msg);
-    StringUtils_appendDecimal(UltrasonicSensorMonitor_currentDistance(), 3, 1, msg);
-    CharString_appendP(PSTR(",Vb:"), msg);
-    StringUtils_appendDecimal(BatteryMonitor_currentVoltage(), 1, 2, msg);
-    CharString_appendP(PSTR(",Vc:"), msg);
-    StringUtils_appendDecimal(CellularComm_batteryMillivolts(), 1, 3, msg);
-    CharString_appendP(PSTR(",T:"), msg);
+        ReplyWriter_writeC('.', msg);
+        ReplyWriter_writeDecimal(CellularTCPIP_state(), 2, 0, msg);
+    }
+    ReplyWriter_writeP(PSTR(","), msg);
+    ReplyWriter_writeDecimal(WaterLevelMonitor_state(), 1, 0, msg);
+    ReplyWriter_writeP(PSTR(",U:"), msg);
+    ReplyWriter_writeDecimal(UltrasonicSensorMonitor_currentDistance(), 3, 1, msg);
+    ReplyWriter_writeP(PSTR(",Vb:"), msg);
+    ReplyWriter_writeDecimal(BatteryMonitor_currentVoltage(), 1, 2, msg);
+    ReplyWriter_writeP(PSTR(",Vc:"), msg);
+    ReplyWriter_writeDecimal(CellularComm_batteryMillivolts(), 1, 3, msg);
+    ReplyWriter_writeP(PSTR(",T:"), msg);
     if (InternalTemperatureMonitor_haveValidSample()) {
-        StringUtils_appendDecimal(InternalTemperatureMonitor_currentTemperature(), 1, 0, msg);
+        ReplyWriter_writeDecimal(InternalTemperatureMonitor_currentTemperature(), 1, 0, msg);
     } else {
-        CharString_appendP(PSTR("__"), msg);
+        ReplyWriter_writeP(PSTR("__"), msg);
     }
-    CharString_appendP(PSTR(",r:"), msg);
-    StringUtils_appendDecimal((int)CellularComm_registrationStatus(), 1, 0, msg);
-    CharString_appendP(PSTR(",q:"), msg);
-    StringUtils_appendDecimal(CellularComm_SignalQuality(), 2, 0, msg);
-    CharString_appendP(PSTR("  "), msg);
+    ReplyWriter_writeP(PSTR(",r:"), msg);
+    ReplyWriter_writeDecimal((int)CellularComm_registrationStatus(), 1, 0, msg);
+    ReplyWriter_writeP(PSTR(",q:"), msg);
+    ReplyWriter_writeDecimal(CellularComm_SignalQuality(), 2, 0, msg);
+    // deepest stack / RAM never used @ task that went deepest
+    ReplyWriter_writeP(PSTR(",S:"), msg);
+    ReplyWriter_writeDecimal(RAMSentinel_stackHighWater(), 1, 0, msg);
+    ReplyWriter_writeC('/', msg);
+    ReplyWriter_writeDecimal(RAMSentinel_freeMargin(), 1, 0, msg);
+    ReplyWriter_writeC('@', msg);
+    ReplyWriter_writeDecimal(RAMSentinel_highWaterTaskID(), 1, 0, msg);
+    ReplyWriter_writeP(PSTR("  "), msg);
+}
+
+void CommandProcessor_createStatusMessage (
+    CharString_t *msg)
+{
+    CharString_clear(msg);
+    ReplyWriter_t msgWriter;
+    ReplyWriter_initForString(msg, &msgWriter);
+    CommandProcessor_writeStatusMessage(&msgWriter);
 }
 
 static int16_t scanIntegerToken (
@@ -113,357 +169,987 @@ static uint32_t scanIntegerU32Token (
 }
 
 static void beginJSON (
-    CharString_t *str)
+    ReplyWriter_t *reply)
 {
-    CharString_copyP(PSTR("{"), str);
+    ReplyWriter_writeC('{', reply);
 }
 
 static void continueJSON (
-    CharString_t *str)
+    ReplyWriter_t *reply)
 {
-    CharString_appendC(',', str);
+    ReplyWriter_writeC(',', reply);
 }
 
 static void endJSON (
-    CharString_t *str)
+    ReplyWriter_t *reply)
 {
-    CharString_appendC('}', str);
+    ReplyWriter_writeC('}', reply);
 }
 
+static void appendJSONName (
+    PGM_P name,
+    ReplyWriter_t *reply)
+{
+    ReplyWriter_writeC('\"', reply);
+    ReplyWriter_writeP(name, reply);
+    ReplyWriter_writeP(PSTR("\":"), reply);
+}
+
+// string values are streamed straight from their place in EEPROM
 static void appendJSONStrValue (
     PGM_P name,
-    StringProvider strProvider,
-    CharString_t *str)
+    const char *eeValue,
+    ReplyWriter_t *reply)
 {
-    CharString_appendC('\"', str);
-    CharString_appendP(name, str);
-    CharString_appendP(PSTR("\":\""), str);
-    strProvider(str);
-    CharString_appendC('\"', str);
+    appendJSONName(name, reply);
+    ReplyWriter_writeC('\"', reply);
+    ReplyWriter_writeEEPROMString(eeValue, reply);
+    ReplyWriter_writeC('\"', reply);
 }
 
 static void appendJSONIntValue (
     PGM_P name,
     const int16_t value,
-    CharString_t *str)
+    ReplyWriter_t *reply)
 {
-    CharString_appendC('\"', str);
-    CharString_appendP(name, str);
-    CharString_appendP(PSTR("\":"), str);
-    StringUtils_appendDecimal(value, 1, 0, str);
+    appendJSONName(name, reply);
+    ReplyWriter_writeDecimal(value, 1, 0, reply);
 }
 
 static void appendJSONTimeValue (
     PGM_P name,
     const SystemTime_t *time,
-    CharString_t *str)
+    ReplyWriter_t *reply)
 {
-    CharString_appendC('\"', str);
-    CharString_appendP(name, str);
-    CharString_appendP(PSTR("\":\""), str);
-    SystemTime_appendToString(time, str);
-    CharString_appendC('\"', str);
+    appendJSONName(name, reply);
+    ReplyWriter_writeC('\"', reply);
+    writeTime(time, reply);
+    ReplyWriter_writeC('\"', reply);
 }
 
 static void makeJSONStrValue (
     PGM_P name,
-    StringProvider strProvider,
-    CharString_t *str)
+    const char *eeValue,
+    ReplyWriter_t *reply)
 {
-    beginJSON(str);
-    appendJSONStrValue(name, strProvider, str);
-    endJSON(str);
+    beginJSON(reply);
+    appendJSONStrValue(name, eeValue, reply);
+    endJSON(reply);
 }
 
 static void makeJSONIntValue (
     PGM_P name,
     const int16_t value,
-    CharString_t *str)
+    ReplyWriter_t *reply)
 {
-    beginJSON(str);
-    appendJSONIntValue(name, value, str);
-    endJSON(str);
+    beginJSON(reply);
+    appendJSONIntValue(name, value, reply);
+    endJSON(reply);
 }
 
-bool CommandProcessor_executeCommand (
-    const CharStringSpan_t* command,
-    CharString_t *reply)
+//
+// Settings accessible through the set and get commands
+//
+
+// how a setting's value is scanned from a set command and
+// formatted for a get command
+typedef enum SettingType_enum {
+    st_uint8,
+    st_int16,
+    st_uint16,
+    st_string,
+    st_custom   // setting has its own parse/format functions
+} SettingType;
+
+typedef bool (*CustomSetter)(
+    CharStringSpan_t *args);
+typedef void (*CustomGetter)(
+    ReplyWriter_t *reply);
+
+typedef union SettingSetter_union {
+    void (*setUInt8)(const uint8_t value);
+    void (*setInt16)(const int16_t value);
+    void (*setUInt16)(const uint16_t value);
+    void (*setString)(const CharStringSpan_t *value);
+    CustomSetter setCustom;
+} SettingSetter;
+
+typedef union SettingGetter_union {
+    uint8_t (*getUInt8)(void);
+    int16_t (*getInt16)(void);
+    uint16_t (*getUInt16)(void);
+    const char *eeString;
+    CustomGetter getCustom;
+} SettingGetter;
+
+typedef struct SettingDescriptor_struct {
+    PGM_P name;
+    SettingType type;
+    SettingSetter set;  // 0 if setting can't be set
+    SettingGetter get;  // 0 if setting can't be read
+} SettingDescriptor;
+
+static bool setAPNSetting (
+    CharStringSpan_t *args)
 {
-    bool validCommand = true;
+    CharStringSpan_t value;
+    StringUtils_scanQuotedString(args, &value, args);
+    EEPROMStorage_setAPN(&value);
+    StringUtils_scanQuotedString(args, &value, args);
+    EEPROMStorage_setUsername(&value);
+    StringUtils_scanQuotedString(args, &value, args);
+    EEPROMStorage_setPassword(&value);
 
-    CharStringSpan_t cmd = *command;
-    CharStringSpan_t cmdToken;
-    StringUtils_scanToken(&cmd, &cmdToken);
-    if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("status"))) {
-        CharStringSpan_t statusToNumber;
-        CharStringSpan_clear(&statusToNumber);
-        StringUtils_scanToken(&cmd, &cmdToken);
-        if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("to"))) {
-            StringUtils_scanToken(&cmd, &statusToNumber);
-        }
-	// return status info
-	CommandProcessor_createStatusMessage(reply);
-        if (!CharStringSpan_isEmpty(&statusToNumber)) {
-            CellularComm_setOutgoingSMSMessageNumber(&statusToNumber);
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("tset"))) {
-        const uint32_t serverTime = scanIntegerU32Token(&cmd, &validCommand);
-        if (validCommand && (serverTime != 0)) {
-            SystemTime_setTimeAdjustment(&serverTime);
-        }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("set"))) {
-        StringUtils_scanToken(&cmd, &cmdToken);
-        if (CharStringSpan_equalsNocaseP(&cmdToken, idP)) {
-            const uint8_t id = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setUnitID(id);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, tCalOffsetP)) {
-            const int16_t tempCalOffset = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setTempCalOffset(tempCalOffset);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, wdtCalP)) {
-            const uint8_t wdtCal = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setWatchdogTimerCal(wdtCal);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, batCalP)) {
-            const uint8_t batCal = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setBatteryVoltageCal(batCal);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, wlmTimeoutP)) {
-            const uint16_t wlmTimeout = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setMonitorTaskTimeout(wlmTimeout);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, rebootP)) {
-            const uint16_t rebootInterval = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setRebootInterval(rebootInterval);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, apnP)) {
-            StringUtils_scanQuotedString(&cmd, &cmdToken, &cmd);
-            EEPROMStorage_setAPN(&cmdToken);
-            StringUtils_scanQuotedString(&cmd, &cmdToken, &cmd);
-            EEPROMStorage_setUsername(&cmdToken);
-            StringUtils_scanQuotedString(&cmd, &cmdToken, &cmd);
-            EEPROMStorage_setPassword(&cmdToken);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, cipqsendP)) {
-            const uint16_t qsend = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setCipqsend(qsend);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, ipserverP)) {
-            StringUtils_scanToken(&cmd, &cmdToken);
-            const uint16_t ipPort = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setIPConsoleServerAddress(&cmdToken);
-                EEPROMStorage_setIPConsoleServerPort(ipPort);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, sampleIntervalP)) {
-            const uint16_t sampleInterval = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setSampleInterval(sampleInterval);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, logIntervalP)) {
-            const uint16_t loggingInterval = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setLoggingUpdateInterval(loggingInterval);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, emptyP)) {
-            const uint16_t emptyDistance = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setWaterTankEmptyDistance(emptyDistance);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, fullP)) {
-            const uint16_t fullDistance = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setWaterTankFullDistance(fullDistance);
+    return true;
+}
+
+static void getAPNSetting (
+    ReplyWriter_t *reply)
+{
+    beginJSON(reply);
+    appendJSONStrValue(apnP, apn, reply);
+    continueJSON(reply);
+    appendJSONStrValue(PSTR("User"), username, reply);
+    continueJSON(reply);
+    appendJSONStrValue(PSTR("Passwd"), password, reply);
+    endJSON(reply);
+}
+
+static void getDistanceSetting (
+    ReplyWriter_t *reply)
+{
+    beginJSON(reply);
+    appendJSONIntValue(emptyP, SettingsShadow_waterTankEmptyDistance(), reply);
+    continueJSON(reply);
+    appendJSONIntValue(fullP, SettingsShadow_waterTankFullDistance(), reply);
+    endJSON(reply);
+}
+
+static bool setIPServerSetting (
+    CharStringSpan_t *args)
+{
+    bool isValid = true;
+    CharStringSpan_t address;
+    StringUtils_scanToken(args, &address);
+    const uint16_t ipPort = scanIntegerToken(args, &isValid);
+    if (isValid) {
+        EEPROMStorage_setIPConsoleServerAddress(&address);
+        EEPROMStorage_setIPConsoleServerPort(ipPort);
+    }
+
+    return isValid;
+}
+
+static void getIPServerSetting (
+    ReplyWriter_t *reply)
+{
+    beginJSON(reply);
+    appendJSONStrValue(PSTR("IP_Addr"), ipConsoleServerAddress, reply);
+    continueJSON(reply);
+    appendJSONIntValue(PSTR("IP_Port"), EEPROMStorage_ipConsoleServerPort(), reply);
+    endJSON(reply);
+}
+
+static void getNotifySetting (
+    ReplyWriter_t *reply)
+{
+    beginJSON(reply);
+    appendJSONIntValue(lowP, SettingsShadow_waterLowNotificationLevel(), reply);
+    continueJSON(reply);
+    appendJSONIntValue(highP, SettingsShadow_waterHighNotificationLevel(), reply);
+    continueJSON(reply);
+    appendJSONIntValue(risingP, SettingsShadow_levelIncreaseNotificationThreshold(), reply);
+    endJSON(reply);
+}
+
+static bool setThingspeakOn (
+    CharStringSpan_t *args)
+{
+    EEPROMStorage_setThingspeak(true);
+    return true;
+}
+
+static bool setThingspeakOff (
+    CharStringSpan_t *args)
+{
+    EEPROMStorage_setThingspeak(false);
+    return true;
+}
+
+// sub-settings of "set thingspeak".
+// table must be maintained in case-insensitive ASCII collation order
+static SettingDescriptor thingspeakSettingTable[] PROGMEM =
+{
+    {addressP,  st_string,  {.setString = EEPROMStorage_setThingspeakHostAddress},  {0}},
+    {offP,      st_custom,  {.setCustom = setThingspeakOff},                        {0}},
+    {onP,       st_custom,  {.setCustom = setThingspeakOn},                         {0}},
+    {portP,     st_uint16,  {.setUInt16 = EEPROMStorage_setThingspeakHostPort},     {0}},
+    {writekeyP, st_string,  {.setString = EEPROMStorage_setThingspeakWriteKey},     {0}}
+};
+static const int thingspeakSettingTableSize =
+    sizeof(thingspeakSettingTable) / sizeof(SettingDescriptor);
+
+static bool setSettingFromTable (
+    const SettingDescriptor table[],
+    const int tableSize,
+    CharStringSpan_t *args);
+
+static bool setThingspeakSetting (
+    CharStringSpan_t *args)
+{
+    return setSettingFromTable(thingspeakSettingTable, thingspeakSettingTableSize, args);
+}
+
+static void getThingspeakSetting (
+    ReplyWriter_t *reply)
+{
+    beginJSON(reply);
+    appendJSONIntValue(PSTR("TS_En"), EEPROMStorage_thingspeakEnabled() ? 1 : 0, reply);
+    continueJSON(reply);
+    appendJSONStrValue(PSTR("TS_Addr"), thingspeakHostAddress, reply);
+    continueJSON(reply);
+    appendJSONIntValue(PSTR("TS_Port"), EEPROMStorage_thingspeakHostPort(), reply);
+    continueJSON(reply);
+    appendJSONStrValue(PSTR("TS_WK"), thingspeakWriteKey, reply);
+    endJSON(reply);
+}
+
+static void getTimeSetting (
+    ReplyWriter_t *reply)
+{
+    beginJSON(reply);
+    SystemTime_t time;
+    SystemTime_getCurrentTime(&time);
+    appendJSONTimeValue(PSTR("CurTime"), &time, reply);
+    continueJSON(reply);
+    time.seconds = SystemTime_uptime();
+    time.hundredths = 0;
+    appendJSONTimeValue(PSTR("uptime"), &time, reply);
+    endJSON(reply);
+}
+
+// settings for the set and get commands.
+// table must be maintained in case-insensitive ASCII collation order
+static SettingDescriptor settingTable[] PROGMEM =
+{
+    {apnP,              st_custom,  {.setCustom = setAPNSetting},
+                                    {.getCustom = getAPNSetting}},
+    {batCalP,           st_uint8,   {.setUInt8 = SettingsShadow_setBatteryVoltageCal},
+                                    {.getUInt8 = SettingsShadow_batteryVoltageCal}},
+    {cipqsendP,         st_uint8,   {.setUInt8 = SettingsShadow_setCipqsend},
+                                    {.getUInt8 = SettingsShadow_cipqsend}},
+    {distanceP,         st_custom,  {0},
+                                    {.getCustom = getDistanceSetting}},
+    {emptyP,            st_uint16,  {.setUInt16 = SettingsShadow_setWaterTankEmptyDistance},
+                                    {.getUInt16 = SettingsShadow_waterTankEmptyDistance}},
+    {fullP,             st_uint16,  {.setUInt16 = SettingsShadow_setWaterTankFullDistance},
+                                    {.getUInt16 = SettingsShadow_waterTankFullDistance}},
+    {idP,               st_uint16,  {.setUInt16 = SettingsShadow_setUnitID},
+                                    {.getUInt16 = SettingsShadow_unitID}},
+    {ipserverP,         st_custom,  {.setCustom = setIPServerSetting},
+                                    {.getCustom = getIPServerSetting}},
+    {logIntervalP,      st_uint16,  {.setUInt16 = SettingsShadow_setLoggingUpdateInterval},
+                                    {.getUInt16 = SettingsShadow_loggingUpdateInterval}},
+    {notifyP,           st_custom,  {0},
+                                    {.getCustom = getNotifySetting}},
+    {pinP,              st_string,  {0},
+                                    {.eeString = cellPIN}},
+    {rebootP,           st_uint16,  {.setUInt16 = SettingsShadow_setRebootInterval},
+                                    {.getUInt16 = SettingsShadow_rebootInterval}},
+    {sampleIntervalP,   st_uint16,  {.setUInt16 = SettingsShadow_setSampleInterval},
+                                    {.getUInt16 = SettingsShadow_sampleInterval}},
+    {tCalOffsetP,       st_int16,   {.setInt16 = SettingsShadow_setTempCalOffset},
+                                    {.getInt16 = SettingsShadow_tempCalOffset}},
+    {thingspeakP,       st_custom,  {.setCustom = setThingspeakSetting},
+                                    {.getCustom = getThingspeakSetting}},
+    {timeP,             st_custom,  {0},
+                                    {.getCustom = getTimeSetting}},
+    {wdtCalP,           st_uint8,   {.setUInt8 = SettingsShadow_setWatchdogTimerCal},
+                                    {.getUInt8 = SettingsShadow_watchdogTimerCal}},
+    {wlmTimeoutP,       st_uint16,  {.setUInt16 = SettingsShadow_setMonitorTaskTimeout},
+                                    {.getUInt16 = SettingsShadow_monitorTaskTimeout}}
+};
+static const int settingTableSize =
+    sizeof(settingTable) / sizeof(SettingDescriptor);
+
+static bool setNotificationOn (
+    CharStringSpan_t *args)
+{
+    SettingsShadow_setNotification(true);
+    return true;
+}
+
+static bool setNotificationOff (
+    CharStringSpan_t *args)
+{
+    SettingsShadow_setNotification(false);
+    return true;
+}
+
+// settings for the notify command.
+// table must be maintained in case-insensitive ASCII collation order
+static SettingDescriptor notifySettingTable[] PROGMEM =
+{
+    {highP,     st_uint8,   {.setUInt8 = SettingsShadow_setWaterHighNotificationLevel},         {0}},
+    {lowP,      st_uint8,   {.setUInt8 = SettingsShadow_setWaterLowNotificationLevel},          {0}},
+    {offP,      st_custom,  {.setCustom = setNotificationOff},                                  {0}},
+    {onP,       st_custom,  {.setCustom = setNotificationOn},                                   {0}},
+    {risingP,   st_uint8,   {.setUInt8 = SettingsShadow_setLevelIncreaseNotificationThreshold}, {0}}
+};
+static const int notifySettingTableSize =
+    sizeof(notifySettingTable) / sizeof(SettingDescriptor);
+
+// scans the setting name from args and looks it up in the given table.
+// returns false if not found
+static bool lookupSetting (
+    const SettingDescriptor table[],
+    const int tableSize,
+    CharStringSpan_t *args,
+    SettingDescriptor *setting)
+{
+    CharStringSpan_t settingName;
+    StringUtils_scanToken(args, &settingName);
+    const int settingIndex = StringUtils_lookupNameNocase(
+        &settingName, table, sizeof(SettingDescriptor), tableSize);
+    if (settingIndex < tableSize) {
+        memcpy_P(setting, &table[settingIndex], sizeof(SettingDescriptor));
+        return true;
+    } else {
+        return false;
+    }
+}
+
+static bool setSettingFromTable (
+    const SettingDescriptor table[],
+    const int tableSize,
+    CharStringSpan_t *args)
+{
+    SettingDescriptor setting;
+    if (!(lookupSetting(table, tableSize, args, &setting) &&
+          (setting.set.setCustom != 0))) {
+        return false;
+    }
+
+    bool isValid = true;
+    switch (setting.type) {
+        case st_uint8 : {
+                const uint8_t value = scanIntegerToken(args, &isValid);
+                if (isValid) {
+                    setting.set.setUInt8(value);
+                }
             }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, thingspeakP)) {
-            StringUtils_scanToken(&cmd, &cmdToken);
-            if (CharStringSpan_equalsNocaseP(&cmdToken, onP)) {
-                EEPROMStorage_setThingspeak(true);
-            } else if (CharStringSpan_equalsNocaseP(&cmdToken, offP)) {
-                EEPROMStorage_setThingspeak(false);
-            } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("address"))) {
-                StringUtils_scanToken(&cmd, &cmdToken);
-                if (!CharStringSpan_isEmpty(&cmdToken)) {
-                    EEPROMStorage_setThingspeakHostAddress(&cmdToken);
+            break;
+        case st_int16 : {
+                const int16_t value = scanIntegerToken(args, &isValid);
+                if (isValid) {
+                    setting.set.setInt16(value);
                 }
-            } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("port"))) {
-                const uint16_t port = scanIntegerToken(&cmd, &validCommand);
-                if (validCommand) {
-                    EEPROMStorage_setThingspeakHostPort(port);
+            }
+            break;
+        case st_uint16 : {
+                const uint16_t value = scanIntegerToken(args, &isValid);
+                if (isValid) {
+                    setting.set.setUInt16(value);
                 }
-            } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("writekey"))) {
-                StringUtils_scanToken(&cmd, &cmdToken);
-                if (!CharStringSpan_isEmpty(&cmdToken)) {
-                    EEPROMStorage_setThingspeakWriteKey(&cmdToken);
+            }
+            break;
+        case st_string : {
+                CharStringSpan_t value;
+                StringUtils_scanToken(args, &value);
+                if (!CharStringSpan_isEmpty(&value)) {
+                    setting.set.setString(&value);
                 }
-            } else {
-                validCommand = false;
             }
-        } else {
-            validCommand = false;
+            break;
+        case st_custom :
+            isValid = setting.set.setCustom(args);
+            break;
+    }
+
+    return isValid;
+}
+
+static bool getSettingFromTable (
+    const SettingDescriptor table[],
+    const int tableSize,
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    SettingDescriptor setting;
+    if (!(lookupSetting(table, tableSize, args, &setting) &&
+          (setting.get.getCustom != 0))) {
+        return false;
+    }
+
+    switch (setting.type) {
+        case st_uint8 :
+            makeJSONIntValue(setting.name, setting.get.getUInt8(), reply);
+            break;
+        case st_int16 :
+            makeJSONIntValue(setting.name, setting.get.getInt16(), reply);
+            break;
+        case st_uint16 :
+            makeJSONIntValue(setting.name, setting.get.getUInt16(), reply);
+            break;
+        case st_string :
+            makeJSONStrValue(setting.name, setting.get.eeString, reply);
+            break;
+        case st_custom :
+            setting.get.getCustom(reply);
+            break;
+    }
+
+    return true;
+}
+
+//
+// Commands
+//
+
+typedef bool (*CommandHandler)(
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply);
+
+typedef struct CommandDescriptor_struct {
+    PGM_P name;
+    CommandHandler handler;
+    bool hasReply;  // command writes a reply when successful
+} CommandDescriptor;
+
+static bool ackCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // host has received samples up to the given sequence number
+    bool isValid = true;
+    const uint32_t lastSeq = scanIntegerU32Token(args, &isValid);
+    if (isValid) {
+        WaterLevelMonitor_acknowledgeSamples(lastSeq);
+    }
+
+    return isValid;
+}
+
+#if BYTEQUEUE_HIGHWATERMARK_ENABLED
+static bool bqhwCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // byte queue report highwater
+    SoftwareSerialRx0_reportHighwater();
+    SoftwareSerialRx2_reportHighwater();
+    SoftwareSerialTx_reportHighwater();
+    UART_reportHighwater();
+
+    return true;
+}
+#endif
+
+#if EEPROM_SNAPSHOTS_ENABLED
+//
+// EEPROM snapshots
+//
+// A range of EEPROM is dumped as a hex string together with its CRC-CCITT
+// (initial value 0xFFFF) so that a whole settings block can be audited or
+// restored in a few commands instead of one command per byte. The CRC
+// covers the address and length (each high byte first) ahead of the data,
+// so a blob is only accepted back at the place it came from. A restore
+// that doesn't fit on one command line is sent as several eeload lines
+// in a host command block; the server sends blocks in pieces that fit in
+// the host command queue.
+//
+
+static uint16_t rangeCRC (
+    const uint16_t eeAddr,
+    const uint16_t length)
+{
+    uint16_t crc = 0xFFFF;
+    crc = _crc_ccitt_update(crc, eeAddr >> 8);
+    crc = _crc_ccitt_update(crc, eeAddr & 0xFF);
+    crc = _crc_ccitt_update(crc, length >> 8);
+    crc = _crc_ccitt_update(crc, length & 0xFF);
+    return crc;
+}
+
+static uint16_t eepromCRC (
+    const uint16_t eeAddr,
+    const uint16_t length)
+{
+    uint16_t crc = rangeCRC(eeAddr, length);
+    for (uint16_t i = 0; i < length; ++i) {
+        crc = _crc_ccitt_update(crc, EEPROM_read((uint8_t*)(eeAddr + i)));
+    }
+    return crc;
+}
+
+static void writeHexDigit (
+    const uint8_t digit,
+    ReplyWriter_t *reply)
+{
+    ReplyWriter_writeC((digit < 10) ? ('0' + digit) : ('a' - 10 + digit), reply);
+}
+
+static void writeHexByte (
+    const uint8_t byte,
+    ReplyWriter_t *reply)
+{
+    writeHexDigit(byte >> 4, reply);
+    writeHexDigit(byte & 0x0F, reply);
+}
+
+// returns 0..15, or 0xFF if the character is not a hex digit
+static uint8_t hexDigitValue (
+    const char ch)
+{
+    if ((ch >= '0') && (ch <= '9')) {
+        return ch - '0';
+    } else if ((ch >= 'a') && (ch <= 'f')) {
+        return ch - 'a' + 10;
+    } else if ((ch >= 'A') && (ch <= 'F')) {
+        return ch - 'A' + 10;
+    } else {
+        return 0xFF;
+    }
+}
+
+// returns the byte value of the pair of hex digits at index 2*i of hex,
+// or a value > 0xFF if they are not valid hex digits
+static uint16_t hexByteAt (
+    const CharStringSpan_t *hex,
+    const uint16_t i)
+{
+    const uint8_t hi = hexDigitValue(CharStringSpan_begin(hex)[2 * i]);
+    const uint8_t lo = hexDigitValue(CharStringSpan_begin(hex)[(2 * i) + 1]);
+    return ((hi | lo) & 0xF0)
+        ? 0xFFFF
+        : ((hi << 4) | lo);
+}
+
+static uint16_t scanHexToken (
+    CharStringSpan_t *str,
+    bool *isValid)
+{
+    CharStringSpan_t token;
+    StringUtils_scanToken(str, &token);
+    const uint16_t numDigits = CharStringSpan_length(&token);
+    uint16_t value = 0;
+    if ((numDigits == 0) || (numDigits > 4)) {
+        *isValid = false;
+    }
+    for (uint16_t i = 0; *isValid && (i < numDigits); ++i) {
+        const uint8_t digit = hexDigitValue(CharStringSpan_begin(&token)[i]);
+        if (digit > 0x0F) {
+            *isValid = false;
         }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("get"))) {
-        StringUtils_scanToken(&cmd, &cmdToken);
-        if (CharStringSpan_equalsNocaseP(&cmdToken, pinP)) {
-            makeJSONStrValue(pinP, EEPROMStorage_getPIN, reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, idP)) {
-            makeJSONIntValue(idP, EEPROMStorage_unitID(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, tCalOffsetP)) {
-            makeJSONIntValue(tCalOffsetP, EEPROMStorage_tempCalOffset(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, wdtCalP)) {
-            makeJSONIntValue(wdtCalP, EEPROMStorage_watchdogTimerCal(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, batCalP)) {
-            makeJSONIntValue(batCalP, EEPROMStorage_batteryVoltageCal(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, wlmTimeoutP)) {
-            makeJSONIntValue(wlmTimeoutP, EEPROMStorage_monitorTaskTimeout(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, rebootP)) {
-            makeJSONIntValue(rebootP, EEPROMStorage_rebootInterval(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, apnP)) {
-            beginJSON(reply);
-            appendJSONStrValue(apnP, EEPROMStorage_getAPN, reply);
-            continueJSON(reply);
-            appendJSONStrValue(PSTR("User"), EEPROMStorage_getUsername, reply);
-            continueJSON(reply);
-            appendJSONStrValue(PSTR("Passwd"), EEPROMStorage_getPassword, reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, cipqsendP)) {
-            makeJSONIntValue(cipqsendP, EEPROMStorage_cipqsend(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("distance"))) {
-            beginJSON(reply);
-            appendJSONIntValue(emptyP, EEPROMStorage_waterTankEmptyDistance(), reply);
-            continueJSON(reply);
-            appendJSONIntValue(fullP, EEPROMStorage_waterTankFullDistance(), reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, ipserverP)) {
-            beginJSON(reply);
-            appendJSONStrValue(PSTR("IP_Addr"), EEPROMStorage_getIPConsoleServerAddress, reply);
-            continueJSON(reply);
-            appendJSONIntValue(PSTR("IP_Port"), EEPROMStorage_ipConsoleServerPort(), reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, sampleIntervalP)) {
-            makeJSONIntValue(sampleIntervalP, EEPROMStorage_sampleInterval(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, logIntervalP)) {
-            makeJSONIntValue(logIntervalP, EEPROMStorage_LoggingUpdateInterval(), reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, thingspeakP)) {
-            beginJSON(reply);
-            appendJSONIntValue(PSTR("TS_En"), EEPROMStorage_thingspeakEnabled() ? 1 : 0, reply);
-            continueJSON(reply);
-            appendJSONStrValue(PSTR("TS_Addr"), EEPROMStorage_getThingspeakHostAddress, reply);
-            continueJSON(reply);
-            appendJSONIntValue(PSTR("TS_Port"), EEPROMStorage_thingspeakHostPort(), reply);
-            continueJSON(reply);
-            appendJSONStrValue(PSTR("TS_WK"), EEPROMStorage_getThingspeakWriteKey, reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, notifyP)) {
-            beginJSON(reply);
-            appendJSONIntValue(lowP, EEPROMStorage_waterLowNotificationLevel(), reply);
-            continueJSON(reply);
-            appendJSONIntValue(highP, EEPROMStorage_waterHighNotificationLevel(), reply);
-            continueJSON(reply);
-            appendJSONIntValue(risingP, EEPROMStorage_levelIncreaseNotificationThreshold(), reply);
-            endJSON(reply);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("time"))) {
-            beginJSON(reply);
-            SystemTime_t time;
-            SystemTime_getCurrentTime(&time);
-            appendJSONTimeValue(PSTR("CurTime"), &time, reply);
-            continueJSON(reply);
-            time.seconds = SystemTime_uptime();
-            time.hundredths = 0;
-            appendJSONTimeValue(PSTR("uptime"), &time, reply);
-            endJSON(reply);
-        } else {
-            validCommand = false;
+        value = (value << 4) | digit;
+    }
+    return value;
+}
+
+static bool eepromRangeIsValid (
+    const uint16_t eeAddr,
+    const uint16_t length)
+{
+    return (length != 0) &&
+           (eeAddr <= E2END) &&
+           (length <= ((E2END + 1) - eeAddr));
+}
+
+static bool eedumpCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // with no arguments dumps the settings block
+    bool isValid = true;
+    uint16_t eeAddr = 0;
+    uint16_t length = EEPROMStorage_settingsSize;
+    StringUtils_skipWhitespace(args);
+    if (!CharStringSpan_isEmpty(args)) {
+        eeAddr = scanIntegerToken(args, &isValid);
+        if (isValid) {
+            length = scanIntegerToken(args, &isValid);
         }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, notifyP)) {
-        StringUtils_scanToken(&cmd, &cmdToken);
-        if (CharStringSpan_equalsNocaseP(&cmdToken, onP)) {
-            EEPROMStorage_setNotification(true);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, offP)) {
-            EEPROMStorage_setNotification(false);
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, lowP)) {
-            const uint16_t level = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setWaterLowNotificationLevel(level);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, highP)) {
-            const uint16_t level = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setWaterHighNotificationLevel(level);
-            }
-        } else if (CharStringSpan_equalsNocaseP(&cmdToken, risingP)) {
-            const uint8_t percentIncrease = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROMStorage_setLevelIncreaseNotificationThreshold(percentIncrease);
-            }
-        } else {
-            validCommand = false;
+    }
+    if (!(isValid && eepromRangeIsValid(eeAddr, length))) {
+        return false;
+    }
+
+    beginJSON(reply);
+    appendJSONIntValue(PSTR("EEAddr"), eeAddr, reply);
+    continueJSON(reply);
+    appendJSONIntValue(PSTR("EELen"), length, reply);
+    continueJSON(reply);
+    appendJSONName(PSTR("EEData"), reply);
+    ReplyWriter_writeC('\"', reply);
+    for (uint16_t i = 0; i < length; ++i) {
+        writeHexByte(EEPROM_read((uint8_t*)(eeAddr + i)), reply);
+    }
+    ReplyWriter_writeC('\"', reply);
+    continueJSON(reply);
+    appendJSONName(PSTR("EECRC"), reply);
+    ReplyWriter_writeC('\"', reply);
+    const uint16_t crc = eepromCRC(eeAddr, length);
+    writeHexByte(crc >> 8, reply);
+    writeHexByte(crc & 0xFF, reply);
+    ReplyWriter_writeC('\"', reply);
+    endJSON(reply);
+
+    return true;
+}
+
+static bool eeloadCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // eeload <addr> <hex data> <hex crc>
+    bool isValid = true;
+    const uint16_t eeAddr = scanIntegerToken(args, &isValid);
+    CharStringSpan_t hexData;
+    StringUtils_scanToken(args, &hexData);
+    const uint16_t numHexDigits = CharStringSpan_length(&hexData);
+    const uint16_t length = numHexDigits / 2;
+    const uint16_t expectedCRC = isValid ? scanHexToken(args, &isValid) : 0;
+    if (!(isValid &&
+          ((numHexDigits & 1) == 0) &&
+          eepromRangeIsValid(eeAddr, length))) {
+        return false;
+    }
+
+    // validate the whole blob before writing any of it
+    uint16_t crc = rangeCRC(eeAddr, length);
+    for (uint16_t i = 0; i < length; ++i) {
+        const uint16_t byte = hexByteAt(&hexData, i);
+        if (byte > 0xFF) {
+            return false;
         }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("sms"))) {
-        // get number to send to
-        CharStringSpan_t recipientNumber;
-        StringUtils_scanToken(&cmd, &recipientNumber);
-        if ((CharStringSpan_length(&recipientNumber) > 5) &&
-            (CharStringSpan_front(&recipientNumber) == '+')) {
-            // got a phone number
-            // get the message to send. it should be a quoted string
-            CharStringSpan_t message;
-            StringUtils_scanQuotedString(&cmd, &message, NULL);
-            if (!CharStringSpan_isEmpty(&message)) {
-                // got the message
-                CharString_copyIters(
-                    CharStringSpan_begin(&message),
-                    CharStringSpan_end(&message),
-                    reply);
-                CellularComm_setOutgoingSMSMessageNumber(&recipientNumber);
-            }
-        } else {
-            validCommand = false;
+        crc = _crc_ccitt_update(crc, byte);
+    }
+    if (crc != expectedCRC) {
+        return false;
+    }
+
+    // only write bytes that differ, to spare EEPROM wear and write time
+    for (uint16_t i = 0; i < length; ++i) {
+        uint8_t *byteAddr = (uint8_t*)(eeAddr + i);
+        const uint8_t byte = hexByteAt(&hexData, i);
+        if (EEPROM_read(byteAddr) != byte) {
+            EEPROM_write(byteAddr, byte);
         }
-#if BYTEQUEUE_HIGHWATERMARK_ENABLED
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("bqhw"))) {
-        // byte queue report highwater
-        SoftwareSerialRx0_reportHighwater();
-        SoftwareSerialRx2_reportHighwater();
-        SoftwareSerialTx_reportHighwater();
-        UART_reportHighwater();
+    }
+    SettingsShadow_reload();
+
+    return true;
+}
+#endif
+
+static bool eereadCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    bool isValid = true;
+    const uint16_t eeAddr = scanIntegerToken(args, &isValid);
+    if (isValid) {
+        beginJSON(reply);
+        appendJSONIntValue(PSTR("EEAddr"), eeAddr, reply);
+        continueJSON(reply);
+        appendJSONIntValue(PSTR("EEVal"), EEPROM_read((uint8_t*)eeAddr), reply);
+        endJSON(reply);
+    }
+
+    return isValid;
+}
+
+static bool eewriteCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    bool isValid = true;
+    const uint16_t eeAddr = scanIntegerToken(args, &isValid);
+    if (isValid) {
+        const uint16_t eeValue = scanIntegerToken(args, &isValid);
+        if (isValid) {
+            EEPROM_write((uint8_t*)eeAddr, eeValue);
+            SettingsShadow_reload();
+        }
+    }
+
+    return isValid;
+}
+
+static bool extendCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    bool isValid = true;
+    const uint16_t seconds = scanIntegerToken(args, &isValid);
+    WaterLevelMonitor_extendTaskTimeout(seconds);
+
+    return isValid;
+}
+
+static bool getCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    return getSettingFromTable(settingTable, settingTableSize, args, reply);
+}
+
+#if SESSIONJOURNAL_ENABLED
+//
+// Session journal
+//
+// Sessions are listed newest first, each as an array of its phase times
+// (power on, bring-up, registration, attach, connect, send and teardown,
+// in 1/10 second), CSQ, bytes sent, bytes received and outcome.
+//
+
+static bool journalCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // with no arguments lists all the sessions in the journal
+    bool isValid = true;
+    uint8_t numSessions = SessionJournal_numEntries;
+    StringUtils_skipWhitespace(args);
+    if (!CharStringSpan_isEmpty(args)) {
+        const int16_t n = scanIntegerToken(args, &isValid);
+        if (!(isValid && (n > 0) && (n <= SessionJournal_numEntries))) {
+            return false;
+        }
+        numSessions = n;
+    }
+
+    beginJSON(reply);
+    appendJSONName(PSTR("SJ"), reply);
+    ReplyWriter_writeC('[', reply);
+    SessionJournal_Entry entry;
+    for (uint8_t age = 0;
+         (age < numSessions) && SessionJournal_getEntry(age, &entry);
+         ++age) {
+        if (age != 0) {
+            ReplyWriter_writeC(',', reply);
+        }
+        ReplyWriter_writeC('[', reply);
+        for (uint8_t phase = 0; phase < sjp_numPhases; ++phase) {
+            ReplyWriter_writeDecimal32(entry.phaseTime[phase], 1, 0, reply);
+            ReplyWriter_writeC(',', reply);
+        }
+        ReplyWriter_writeDecimal(entry.signalQuality, 1, 0, reply);
+        ReplyWriter_writeC(',', reply);
+        ReplyWriter_writeDecimal32(entry.bytesSent, 1, 0, reply);
+        ReplyWriter_writeC(',', reply);
+        ReplyWriter_writeDecimal32(entry.bytesReceived, 1, 0, reply);
+        ReplyWriter_writeC(',', reply);
+        ReplyWriter_writeDecimal(entry.outcome, 1, 0, reply);
+        ReplyWriter_writeC(']', reply);
+    }
+    ReplyWriter_writeC(']', reply);
+    endJSON(reply);
+
+    return true;
+}
+
 #endif
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, rebootP)) {
-        // reboot
-        SystemTime_commenceShutdown();
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("extend"))) {
-        const uint16_t seconds = scanIntegerToken(&cmd, &validCommand);
-        WaterLevelMonitor_extendTaskTimeout(seconds);
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("eeread"))) {
-        const uint16_t eeAddr = scanIntegerToken(&cmd, &validCommand);
-        if (validCommand) {
-            beginJSON(reply);
-            appendJSONIntValue(PSTR("EEAddr"), eeAddr, reply);
-            continueJSON(reply);
-            appendJSONIntValue(PSTR("EEVal"), EEPROM_read((uint8_t*)eeAddr), reply);
-            endJSON(reply);
+
+#if ATLATENCY_ENABLED
+//
+// AT command latency
+//
+// Each command type's histogram is listed as an array of counts, for
+// latencies under 80ms, 160ms, ... 5.12s, and 5.12s and over.
+//
+
+static void writeLatencyHistogram (
+    const uint8_t commandType,
+    ReplyWriter_t *reply)
+{
+    appendJSONName(ATLatency_commandTypeName(commandType), reply);
+    ReplyWriter_writeC('[', reply);
+    for (uint8_t bucket = 0; bucket < ATLatency_numBuckets; ++bucket) {
+        if (bucket != 0) {
+            ReplyWriter_writeC(',', reply);
         }
-    } else if (CharStringSpan_equalsNocaseP(&cmdToken, PSTR("eewrite"))) {
-        const uint16_t eeAddr = scanIntegerToken(&cmd, &validCommand);
-        if (validCommand) {
-            const uint16_t eeValue = scanIntegerToken(&cmd, &validCommand);
-            if (validCommand) {
-                EEPROM_write((uint8_t*)eeAddr, eeValue);
+        ReplyWriter_writeDecimal(ATLatency_count(commandType, bucket), 1, 0, reply);
+    }
+    ReplyWriter_writeC(']', reply);
+}
+
+static bool latencyCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // with no arguments lists all the command types
+    CharStringSpan_t name;
+    StringUtils_scanToken(args, &name);
+    uint8_t commandType = ATLatency_numCommandTypes;
+    if (!CharStringSpan_isEmpty(&name)) {
+        commandType = ATLatency_lookupCommandType(&name);
+        if (commandType >= ATLatency_numCommandTypes) {
+            return false;
+        }
+    }
+
+    beginJSON(reply);
+    if (commandType < ATLatency_numCommandTypes) {
+        writeLatencyHistogram(commandType, reply);
+    } else {
+        for (uint8_t ct = 0; ct < ATLatency_numCommandTypes; ++ct) {
+            if (ct != 0) {
+                continueJSON(reply);
             }
+            writeLatencyHistogram(ct, reply);
         }
+    }
+    endJSON(reply);
+
+    return true;
+}
+#endif
+
+static bool notifyCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    return setSettingFromTable(notifySettingTable, notifySettingTableSize, args);
+}
+
+static bool rebootCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    SystemTime_commenceShutdown();
+
+    return true;
+}
+
+static bool setCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    return setSettingFromTable(settingTable, settingTableSize, args);
+}
+
+static bool smsCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    // get number to send to
+    CharStringSpan_t recipientNumber;
+    StringUtils_scanToken(args, &recipientNumber);
+    if ((CharStringSpan_length(&recipientNumber) > 5) &&
+        (CharStringSpan_front(&recipientNumber) == '+')) {
+        // got a phone number
+        // get the message to send. it should be a quoted string
+        CharStringSpan_t message;
+        StringUtils_scanQuotedString(args, &message, NULL);
+        if (!CharStringSpan_isEmpty(&message)) {
+            // got the message
+            ReplyWriter_writeCSS(&message, reply);
+            CellularComm_setOutgoingSMSMessageNumber(&recipientNumber);
+        }
+        return true;
     } else {
-        validCommand = false;
-        Console_printP(PSTR("unrecognized command"));
+        return false;
+    }
+}
+
+static bool statusCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    CharStringSpan_t statusToNumber;
+    CharStringSpan_clear(&statusToNumber);
+    CharStringSpan_t token;
+    StringUtils_scanToken(args, &token);
+    if (CharStringSpan_equalsNocaseP(&token, PSTR("to"))) {
+        StringUtils_scanToken(args, &statusToNumber);
+    }
+    // return status info
+    CommandProcessor_writeStatusMessage(reply);
+    if (!CharStringSpan_isEmpty(&statusToNumber)) {
+        CellularComm_setOutgoingSMSMessageNumber(&statusToNumber);
+    }
+
+    return true;
+}
+
+static bool tsetCommand (
+    CharStringSpan_t *args,
+    ReplyWriter_t *reply)
+{
+    bool isValid = true;
+    const uint32_t serverTime = scanIntegerU32Token(args, &isValid);
+    if (isValid && (serverTime != 0)) {
+        SystemTime_setTimeAdjustment(&serverTime);
     }
 
-    return validCommand;
+    return isValid;
+}
+
+// table must be maintained in case-insensitive ASCII collation order
+static CommandDescriptor commandTable[] PROGMEM =
+{
+    {ackP,      ackCommand,     false},
+#if BYTEQUEUE_HIGHWATERMARK_ENABLED
+    {bqhwP,     bqhwCommand,    false},
+#endif
+#if EEPROM_SNAPSHOTS_ENABLED
+    {eedumpP,   eedumpCommand,  true},
+    {eeloadP,   eeloadCommand,  false},
+#endif
+    {eereadP,   eereadCommand,  true},
+    {eewriteP,  eewriteCommand, false},
+    {extendP,   extendCommand,  false},
+    {getP,      getCommand,     true},
+#if SESSIONJOURNAL_ENABLED
+    {journalP,  journalCommand, true},
+#endif
+#if ATLATENCY_ENABLED
+    {latencyP,  latencyCommand, true},
+#endif
+    {notifyP,   notifyCommand,  false},
+    {rebootP,   rebootCommand,  false},
+    {setP,      setCommand,     false},
+    {smsP,      smsCommand,     true},
+    {statusP,   statusCommand,  true},
+    {tsetP,     tsetCommand,    false}
+};
+static const int commandTableSize =
+    sizeof(commandTable) / sizeof(CommandDescriptor);
+
+static int lookupCommand (
+    CharStringSpan_t *cmd)
+{
+    CharStringSpan_t cmdToken;
+    StringUtils_scanToken(cmd, &cmdToken);
+    return StringUtils_lookupNameNocase(
+        &cmdToken, commandTable, sizeof(CommandDescriptor), commandTableSize);
+}
+
+bool CommandProcessor_commandHasReply (
+    const CharStringSpan_t* command)
+{
+    CharStringSpan_t cmd = *command;
+    const int commandIndex = lookupCommand(&cmd);
+    return
+        (commandIndex < commandTableSize) &&
+        pgm_read_byte(&commandTable[commandIndex].hasReply);
+}
+
+bool CommandProcessor_executeCommand (
+    const CharStringSpan_t* command,
+    ReplyWriter_t *reply)
+{
+    CharStringSpan_t cmd = *command;
+    const int commandIndex = lookupCommand(&cmd);
+    if (commandIndex < commandTableSize) {
+        const CommandHandler handler =
+            (CommandHandler)pgm_read_word(&commandTable[commandIndex].handler);
+        return handler(&cmd, reply);
+    } else {
+        Console_printP(PSTR("unrecognized command"));
+        return false;
+    }
 }
 //                uint32_t i1 = 30463UL;
 //                uint32_t i2 = 30582UL;
@@ -12,21 +12,27 @@
 #include <string.h>
 #include <stddef.h>
 #include "CharStringSpan.h"
+#include "ReplyWriter.h"
 
 // buffer that clients can use to accumulate command characters
 extern CharString_t CommandProcessor_incomingCommand;
 
-// output from commands is put into this string
-extern CharString_t CommandProcessor_commandReply;
-
-// creates the status message in CommandProcessor_commandReply
+// writes the status message
+extern void CommandProcessor_writeStatusMessage (
+    ReplyWriter_t *msg);
+// creates the status message in msg
 extern void CommandProcessor_createStatusMessage (
     CharString_t *msg);
 
-// writes response, if any, to CommandProcessor_commandReply
+// returns true if the given command writes a reply (when it
+// is valid)
+extern bool CommandProcessor_commandHasReply (
+    const CharStringSpan_t* command);
+
+// streams response, if any, to reply
 // returns true if given command is valid
 extern bool CommandProcessor_executeCommand (
     const CharStringSpan_t* command,
-    CharString_t *reply);
+    ReplyWriter_t *reply);
 
 #endif  // COMMANDPROCESSOR_H
\ No newline at end of file
@@ -5,6 +5,13 @@
 //      PB4 - serial input
 //      PB3 - serial output
 //
+//  The console is considered connected from the first character received
+//  until it has been idle for CONSOLE_IDLE_TIMEOUT. While it is not
+//  connected nothing is transmitted, so a unit in the field spends no time
+//  bit-banging output that nobody reads. While it is connected the status
+//  line is printed when it changes, and refreshed every
+//  STATUS_REFRESH_INTERVAL regardless.
+//
 #include "Console.h"
 
 #include "SoftwareSerialRx0.h"
@@ -12,11 +19,22 @@
 #include "SystemTime.h"
 #include "CommandProcessor.h"
 #include "StringUtils.h"
+#include "ScratchArena.h"
 #include <avr/io.h>
 #include <avr/pgmspace.h>
+#include <util/crc16.h>
 
 #define SINGLE_SCREEN 0
 
+// set to 1 to treat the console as connected from power-up (for
+// seeing debug output during startup on the bench)
+#define CONSOLE_ALWAYS_CONNECTED 0
+
+// units are 1/100 second
+#define CONSOLE_IDLE_TIMEOUT 30000
+#define STATUS_PRINT_INTERVAL 100
+#define STATUS_REFRESH_INTERVAL 3000
+
 #define TX_CHAN_INDEX 1
 
 #define ANSI_ESCAPE_SEQUENCE(EscapeSeq)  "\33[" EscapeSeq
@@ -28,21 +46,58 @@ const prog_char crP[] = {13,0};
 const prog_char crlfP[] = {13,10,0};
 
 // state variables
+static bool isConnected;
+static SystemTime_t disconnectTime;
 static SystemTime_t nextStatusPrintTime;
+static SystemTime_t nextStatusRefreshTime;
+static uint16_t lastStatusCRC;
 static uint8_t currentPrintLine = 5;
 
 static bool consoleIsConnected (void)
 {
-    return true;
+    return isConnected;
+}
+
+static void connect (void)
+{
+    if (!isConnected) {
+        isConnected = true;
+        SoftwareSerialTx_enable(TX_CHAN_INDEX);
+        SoftwareSerialTx_sendP(TX_CHAN_INDEX, crlfP);
+        // print status right away
+        SystemTime_futureTime(0, &nextStatusPrintTime);
+        SystemTime_futureTime(0, &nextStatusRefreshTime);
+    }
+#if !CONSOLE_ALWAYS_CONNECTED
+    SystemTime_futureTime(CONSOLE_IDLE_TIMEOUT, &disconnectTime);
+#endif
+}
+
+// CRC of the status message, excluding the time that leads it
+static uint16_t statusCRC (
+    const CharString_t *statusMsg)
+{
+    uint16_t crc = 0xFFFF;
+    bool pastTime = false;
+    for (CharString_Iter iter = CharString_begin(statusMsg);
+        iter != CharString_end(statusMsg); ++iter) {
+        if (pastTime) {
+            crc = _crc_ccitt_update(crc, *iter);
+        } else if (*iter == ',') {
+            pastTime = true;
+        }
+    }
+    return crc;
 }
 
 void Console_Initialize (void)
 {
+    // the channel stays disabled until someone types at the console
     SoftwareSerialTx_open(TX_CHAN_INDEX, ps_b, 3);
-    SoftwareSerialTx_enable(TX_CHAN_INDEX);
-    SoftwareSerialTx_sendP(TX_CHAN_INDEX, crlfP);
-
-    SystemTime_futureTime(0, &nextStatusPrintTime); // start right away
+    isConnected = false;
+#if CONSOLE_ALWAYS_CONNECTED
+    connect();
+#endif
 }
 
 void Console_task (void)
@@ -50,16 +105,18 @@ void Console_task (void)
     ByteQueue_t* rxQueue = SoftwareSerial_rx0Queue();
     if (!ByteQueue_is_empty(rxQueue)) {
         char cmdByte = ByteQueue_pop(rxQueue);
+        connect();
         switch (cmdByte) {
             case '\r' : {
                 // command complete. execute it
                 SoftwareSerialTx_sendP(TX_CHAN_INDEX, crlfP);
                 CharStringSpan_t command;
                 CharStringSpan_init(&CommandProcessor_incomingCommand, &command);
-                CommandProcessor_executeCommand(&command, &CommandProcessor_commandReply);
-                if (!CharString_isEmpty(&CommandProcessor_commandReply)) {
-                    Console_printCS(&CommandProcessor_commandReply);
-                    CharString_clear(&CommandProcessor_commandReply);
+                ReplyWriter_t reply;
+                ReplyWriter_initForStream(Console_availableSpace, Console_writeCSS, &reply);
+                CommandProcessor_executeCommand(&command, &reply);
+                if (ReplyWriter_length(&reply) > 0) {
+                    SoftwareSerialTx_sendP(TX_CHAN_INDEX, crlfP);
                 }
                 CharString_clear(&CommandProcessor_incomingCommand);
                 }
@@ -81,23 +138,47 @@ void Console_task (void)
         SoftwareSerialTx_send(TX_CHAN_INDEX, ESC_ERASE_LINE);
     }
 
-    // display status
-    if (consoleIsConnected() &&
-        SystemTime_timeHasArrived(&nextStatusPrintTime)) {
-        CharString_define(80, statusMsg)
-        CommandProcessor_createStatusMessage(&statusMsg);
-        SoftwareSerialTx_sendP(TX_CHAN_INDEX, crP);
-        SoftwareSerialTx_sendCS(TX_CHAN_INDEX, &statusMsg);
-        SoftwareSerialTx_sendP(TX_CHAN_INDEX, crlfP);
+    if (!consoleIsConnected()) {
+        return;
+    }
 
-        if (!CharString_isEmpty(&CommandProcessor_incomingCommand)) {
-            // echo current command
-            SoftwareSerialTx_sendCS(TX_CHAN_INDEX, &CommandProcessor_incomingCommand);
-            SoftwareSerialTx_send(TX_CHAN_INDEX, ESC_ERASE_LINE);
+#if !CONSOLE_ALWAYS_CONNECTED
+    if (SystemTime_timeHasArrived(&disconnectTime) &&
+        SoftwareSerialTx_isIdle(TX_CHAN_INDEX)) {
+        // nobody has typed anything for a while
+        isConnected = false;
+        SoftwareSerialTx_disable(TX_CHAN_INDEX);
+        return;
+    }
+#endif
+
+    // display status if it has changed. the status is skipped while
+    // the scratch arena is too full to build it (during SMS handling)
+    if (SystemTime_timeHasArrived(&nextStatusPrintTime)) {
+        CharString_t statusMsg;
+        if (ScratchArena_allocString(96, &statusMsg)) {
+            CommandProcessor_createStatusMessage(&statusMsg);
+        }
+        const uint16_t crc = statusCRC(&statusMsg);
+        if ((!CharString_isEmpty(&statusMsg)) &&
+            ((crc != lastStatusCRC) ||
+             SystemTime_timeHasArrived(&nextStatusRefreshTime))) {
+            lastStatusCRC = crc;
+            SoftwareSerialTx_sendP(TX_CHAN_INDEX, crP);
+            SoftwareSerialTx_sendCS(TX_CHAN_INDEX, &statusMsg);
+            SoftwareSerialTx_sendP(TX_CHAN_INDEX, crlfP);
+
+            if (!CharString_isEmpty(&CommandProcessor_incomingCommand)) {
+                // echo current command
+                SoftwareSerialTx_sendCS(TX_CHAN_INDEX, &CommandProcessor_incomingCommand);
+                SoftwareSerialTx_send(TX_CHAN_INDEX, ESC_ERASE_LINE);
+            }
+
+            SystemTime_futureTime(STATUS_REFRESH_INTERVAL, &nextStatusRefreshTime);
         }
 
 	// schedule next display
-	SystemTime_futureTime(100, &nextStatusPrintTime);
+	SystemTime_futureTime(STATUS_PRINT_INTERVAL, &nextStatusPrintTime);
     }
 }
 
@@ -169,6 +250,19 @@ void Console_printP (
     }
 }
 
+uint16_t Console_availableSpace (void)
+{
+    return SoftwareSerialTx_availableSpace(TX_CHAN_INDEX);
+}
+
+void Console_writeCSS (
+    const CharStringSpan_t *text)
+{
+    if (consoleIsConnected()) {
+        SoftwareSerialTx_sendCSS(TX_CHAN_INDEX, text);
+    }
+}
+
 void Console_printCS (
     const CharString_t *text)
 {
@@ -28,4 +28,9 @@ extern void Console_printCS (
 extern void Console_printCSS (
     const CharStringSpan_t *text);
 
+// for streaming output (no line ending is added)
+extern uint16_t Console_availableSpace (void);
+extern void Console_writeCSS (
+    const CharStringSpan_t *text);
+
 #endif  // Console_H
@@ -0,0 +1,99 @@
+//
+//  DNS Cache
+//
+//  The SIM800 doesn't report the TTL of the records it looks up, so
+//  cached addresses are kept for a fixed time. The entry is tied to the
+//  host name by a CRC of the name, so changing the server address
+//  setting makes the entry miss.
+//
+
+#include "DNSCache.h"
+
+#if DNSCACHE_ENABLED
+
+#include <ctype.h>
+#include <avr/eeprom.h>
+#include <util/crc16.h>
+#include "EEPROM_Util.h"
+#include "SystemTime.h"
+
+// how long a resolved address is used for, in seconds
+#define DNS_CACHE_TTL 86400L
+
+static uint16_t cachedHostCRC EEMEM;
+static uint32_t cachedTime EEMEM;
+static char cachedAddress[DNSCache_maxAddressLength + 1] EEMEM;
+
+static uint16_t hostCRC (
+    const CharString_t *host)
+{
+    uint16_t crc = 0xFFFF;
+    CharString_Iter iter = CharString_begin(host);
+    const CharString_Iter end = CharString_end(host);
+    while (iter != end) {
+        crc = _crc_ccitt_update(crc, *iter++);
+    }
+    return crc;
+}
+
+bool DNSCache_isAddress (
+    const CharString_t *host)
+{
+    if (CharString_isEmpty(host)) {
+        return false;
+    }
+    CharString_Iter iter = CharString_begin(host);
+    const CharString_Iter end = CharString_end(host);
+    while (iter != end) {
+        const char ch = *iter++;
+        if (!(isdigit(ch) || (ch == '.'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DNSCache_lookup (
+    const CharString_t *host,
+    CharString_t *address)
+{
+    if ((!isdigit(EEPROM_read((const uint8_t*)cachedAddress))) ||
+        (EEPROM_readWord(&cachedHostCRC) != hostCRC(host))) {
+        return false;
+    }
+
+    // the entry has expired if it is older than the TTL, or if it seems
+    // to be from the future (system time was set back since it was stored)
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    const uint32_t storedTime = EEPROM_readLong(&cachedTime);
+    if ((curTime.seconds < storedTime) ||
+        ((curTime.seconds - storedTime) > DNS_CACHE_TTL)) {
+        return false;
+    }
+
+    EEPROM_readString(cachedAddress, address);
+    return true;
+}
+
+void DNSCache_store (
+    const CharString_t *host,
+    const CharStringSpan_t *address)
+{
+    if (CharStringSpan_isEmpty(address) ||
+        (CharStringSpan_length(address) > DNSCache_maxAddressLength)) {
+        return;
+    }
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    EEPROM_writeWord(&cachedHostCRC, hostCRC(host));
+    EEPROM_writeLong(&cachedTime, curTime.seconds);
+    EEPROM_writeString(cachedAddress, sizeof(cachedAddress), address);
+}
+
+void DNSCache_invalidate (void)
+{
+    EEPROM_write((uint8_t*)cachedAddress, 0);
+}
+
+#endif  // DNSCACHE_ENABLED
@@ -0,0 +1,73 @@
+//
+//  DNS Cache
+//
+//  What it does:
+//     Remembers in EEPROM the IP address that a host name last resolved
+//     to, so that a connection can be started by address without having
+//     the cell module look the name up over GPRS every time.
+//
+//  How to use it:
+//     Before connecting to a host name, DNSCache_lookup() appends the
+//     cached address if there is one that hasn't expired. Otherwise
+//     resolve the name and pass the result to DNSCache_store(). If a
+//     connection to a cached address fails, call DNSCache_invalidate()
+//     so that the name is resolved again next time.
+//
+
+#ifndef DNSCACHE_H
+#define DNSCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "CharString.h"
+#include "CharStringSpan.h"
+
+// enable/disable the cache. It doesn't fit in flash along with everything
+// else, so it's left out of normal builds. Without it every host is
+// treated as an address, and the cell module resolves names itself when
+// it connects
+#define DNSCACHE_ENABLED 0
+
+// dotted decimal IPv4 address
+#define DNSCache_maxAddressLength 15
+
+#if DNSCACHE_ENABLED
+
+// returns true if host is already an IP address (so there is nothing
+// to resolve)
+extern bool DNSCache_isAddress (
+    const CharString_t *host);
+
+// if there is an unexpired address for host, appends it to address and
+// returns true
+extern bool DNSCache_lookup (
+    const CharString_t *host,
+    CharString_t *address);
+
+extern void DNSCache_store (
+    const CharString_t *host,
+    const CharStringSpan_t *address);
+
+extern void DNSCache_invalidate (void);
+#else
+inline bool DNSCache_isAddress (
+    const CharString_t *host)
+{
+    return true;
+}
+
+inline bool DNSCache_lookup (
+    const CharString_t *host,
+    CharString_t *address)
+{
+    return false;
+}
+
+inline void DNSCache_store (
+    const CharString_t *host,
+    const CharStringSpan_t *address) {}
+
+inline void DNSCache_invalidate (void) {}
+#endif
+
+#endif  // DNSCACHE_H
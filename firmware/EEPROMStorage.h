@@ -15,6 +15,10 @@
 
 #define EEPROMStorage_maxNotificationNumbers 4
 
+// size of the block of settings at the start of EEPROM. must track the
+// EEMEM layout in EEPROMStorage.c
+#define EEPROMStorage_settingsSize 0xF7
+
 extern void EEPROMStorage_Initialize (void);
 
 extern void EEPROMStorage_setUnitID (
@@ -155,4 +159,15 @@ extern void EEPROMStorage_setIPConsoleServerPort (
     const uint16_t port);
 extern uint16_t EEPROMStorage_ipConsoleServerPort (void); 
 
+// the string settings themselves (EEMEM objects in EEPROMStorage.c), for
+// reading them out a piece at a time instead of copying them into RAM
+// (see ReplyWriter_writeEEPROMString)
+extern char cellPIN[];
+extern char apn[];
+extern char username[];
+extern char password[];
+extern char thingspeakHostAddress[];
+extern char thingspeakWriteKey[];
+extern char ipConsoleServerAddress[];
+
 #endif		// EEPROMSTORAGE
\ No newline at end of file
@@ -5,35 +5,134 @@
 #include "EEPROM_Util.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+
+// Writes are queued and carried out one byte at a time by the EEPROM
+// ready interrupt, so that a caller isn't held up for the 3.3ms each
+// byte takes to program. A write to an address that already has a
+// write pending replaces the pending value. Reads see pending values.
+#define WRITE_QUEUE_LEN 16
+
+// state variables
+static uint16_t pendingAddr[WRITE_QUEUE_LEN];
+static uint8_t pendingData[WRITE_QUEUE_LEN];
+static volatile uint8_t pendingHead;
+static volatile uint8_t pendingCount;
+
+// returns the index in the pending queue of the write to the given
+// address, or -1 if there is none. must be called with interrupts disabled
+static int8_t findPending (
+    const uint16_t addr)
+{
+    uint8_t index = pendingHead;
+    for (uint8_t i = 0; i < pendingCount; ++i) {
+        if (pendingAddr[index] == addr) {
+            return index;
+        }
+        if (++index == WRITE_QUEUE_LEN) {
+            index = 0;
+        }
+    }
+    return -1;
+}
+
+ISR(EE_READY_vect, ISR_BLOCK)
+{
+    if (pendingCount == 0) {
+        // queue drained
+        EECR &= ~(1 << EERIE);
+    } else {
+        EEAR = pendingAddr[pendingHead];
+        EEDR = pendingData[pendingHead];
+        /* Write logical one to EEMPE */
+        EECR |= (1<<EEMPE);
+        /* Start eeprom write by setting EEPE */
+        EECR |= (1<<EEPE);
+        if (++pendingHead == WRITE_QUEUE_LEN) {
+            pendingHead = 0;
+        }
+        --pendingCount;
+    }
+}
 
 void EEPROM_write (
     uint8_t* uiAddress,
     const uint8_t ucData)
 {
-    /* Wait for completion of previous write */
-    while(EECR & (1<<EEPE))
-        ;
-    /* Set up address and Data Registers */
-    EEAR = (uint16_t)uiAddress;
-    EEDR = ucData;
-    /* Write logical one to EEMPE */
-    EECR |= (1<<EEMPE);
-    /* Start eeprom write by setting EEPE */
-    EECR |= (1<<EEPE);
+    const uint16_t addr = (uint16_t)uiAddress;
+    for (;;) {
+        char SREGSave = SREG;
+        cli();
+        const int8_t index = findPending(addr);
+        if (index >= 0) {
+            pendingData[index] = ucData;
+            SREG = SREGSave;
+            return;
+        }
+        if (pendingCount < WRITE_QUEUE_LEN) {
+            uint8_t tail = pendingHead + pendingCount;
+            if (tail >= WRITE_QUEUE_LEN) {
+                tail -= WRITE_QUEUE_LEN;
+            }
+            pendingAddr[tail] = addr;
+            pendingData[tail] = ucData;
+            ++pendingCount;
+            EECR |= (1 << EERIE);
+            SREG = SREGSave;
+            return;
+        }
+        SREG = SREGSave;
+        // queue is full. wait for the interrupt to make room
+    }
 }
 
 uint8_t EEPROM_read (
     const uint8_t* uiAddress)
 {
+    const uint16_t addr = (uint16_t)uiAddress;
+    char SREGSave = SREG;
+    cli();
+    const int8_t index = findPending(addr);
+    if (index >= 0) {
+        const uint8_t data = pendingData[index];
+        SREG = SREGSave;
+        return data;
+    }
+    // keep the interrupt from starting another write while we wait for
+    // the one in progress, if any
+    const bool writesPending = (EECR & (1 << EERIE)) != 0;
+    EECR &= ~(1 << EERIE);
+    SREG = SREGSave;
+
     /* Wait for completion of previous write */
     while (EECR & (1<<EEPE))
         ;
     /* Set up address register */
-    EEAR = (uint16_t)uiAddress;
+    EEAR = addr;
     /* Start eeprom read by writing EERE */
     EECR |= (1<<EERE);
     /* Return data from Data Register */
-    return EEDR;
+    const uint8_t data = EEDR;
+
+    if (writesPending) {
+        cli();
+        EECR |= (1 << EERIE);
+        SREG = SREGSave;
+    }
+    return data;
+}
+
+bool EEPROM_writePending (void)
+{
+    return (pendingCount != 0) || ((EECR & (1<<EEPE)) != 0);
+}
+
+void EEPROM_flush (void)
+{
+    while (EEPROM_writePending()) {
+        wdt_reset();
+    }
 }
 
 void EEPROM_writeString (
@@ -11,13 +11,24 @@
 #include <avr/eeprom.h>
 #include "CharStringSpan.h"
 
+// queues the byte to be written by the EEPROM ready interrupt. only
+// waits if the write queue is full
 extern void EEPROM_write (
     uint8_t* uiAddress,
     const uint8_t ucData);
 
+// returns the value most recently written to the address, whether or
+// not it has reached EEPROM yet
 extern uint8_t EEPROM_read (
     const uint8_t* uiAddress);
 
+// returns true if there are writes that haven't completed
+extern bool EEPROM_writePending (void);
+
+// waits for all queued writes to complete. must be called before
+// sleeping or resetting, since pending writes are lost either way
+extern void EEPROM_flush (void);
+
 extern void EEPROM_writeString (
     char* uiAddress,
     const int maxLength,
@@ -9,7 +9,7 @@
 #include "ADCManager.h"
 #include "SystemTime.h"
 #include "DataHistory.h"
-#include "EEPROMStorage.h"
+#include "SettingsShadow.h"
 
 #define SENSOR_ADC_CHANNEL ADC_SINGLE_ENDED_INPUT_TEMP
 
@@ -62,7 +62,7 @@ int16_t InternalTemperatureMonitor_currentTemperature (void)
 
         int32_t temp = avgTemperature;
         // counts to degrees C
-        const int16_t tempCalOffset = EEPROMStorage_tempCalOffset();
+        const int16_t tempCalOffset = SettingsShadow_tempCalOffset();
         curTempC = ((int16_t)(((temp - tempCalOffset) * NUMERATOR) / RESOLUTION));
     }
 
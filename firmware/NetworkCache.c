@@ -0,0 +1,77 @@
+//
+//  Network Cache
+//
+//  The cache is valid when the stored operator starts with a digit, so
+//  erased EEPROM (0xFF) and an invalidated cache (0) both read as invalid.
+//
+
+#include "NetworkCache.h"
+
+#if NETWORKCACHE_ENABLED
+
+#include <ctype.h>
+#include <avr/eeprom.h>
+#include "EEPROM_Util.h"
+
+static char cachedOperator[NetworkCache_maxOperatorLength + 1] EEMEM;
+static char cachedBand[NetworkCache_maxBandLength + 1] EEMEM;
+
+// returns true if the string stored at the given EEPROM address is
+// the same as str
+static bool storedStringEquals (
+    const char *storedStr,
+    const CharStringSpan_t *str)
+{
+    const uint8_t *charAddr = (const uint8_t*)storedStr;
+    CharString_Iter iter = CharStringSpan_begin(str);
+    const CharString_Iter end = CharStringSpan_end(str);
+    while (iter != end) {
+        if (EEPROM_read(charAddr++) != (uint8_t)*iter++) {
+            return false;
+        }
+    }
+    return EEPROM_read(charAddr) == 0;
+}
+
+bool NetworkCache_isValid (void)
+{
+    return isdigit(EEPROM_read((const uint8_t*)cachedOperator)) &&
+        EEPROM_haveString(cachedBand);
+}
+
+void NetworkCache_getOperator (
+    CharString_t *oper)
+{
+    EEPROM_readString(cachedOperator, oper);
+}
+
+void NetworkCache_getBand (
+    CharString_t *band)
+{
+    EEPROM_readString(cachedBand, band);
+}
+
+void NetworkCache_update (
+    const CharStringSpan_t *oper,
+    const CharStringSpan_t *band)
+{
+    if ((CharStringSpan_length(oper) > NetworkCache_maxOperatorLength) ||
+        (CharStringSpan_length(band) > NetworkCache_maxBandLength) ||
+        CharStringSpan_isEmpty(oper) || CharStringSpan_isEmpty(band)) {
+        // not something we could request later
+        return;
+    }
+    if (!storedStringEquals(cachedBand, band)) {
+        EEPROM_writeString(cachedBand, sizeof(cachedBand), band);
+    }
+    if (!storedStringEquals(cachedOperator, oper)) {
+        EEPROM_writeString(cachedOperator, sizeof(cachedOperator), oper);
+    }
+}
+
+void NetworkCache_invalidate (void)
+{
+    EEPROM_write((uint8_t*)cachedOperator, 0);
+}
+
+#endif  // NETWORKCACHE_ENABLED
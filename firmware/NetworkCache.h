@@ -0,0 +1,69 @@
+//
+//  Network Cache
+//
+//  What it does:
+//     Remembers in EEPROM the operator and band that the cell module last
+//     registered on, so that after a power up the module can be asked to
+//     register on that network first instead of scanning for one.
+//
+//  How to use it:
+//     After the module registers, pass the operator (numeric format) and
+//     band it reports to NetworkCache_update(). Before the module
+//     registers, if NetworkCache_isValid(), get the operator and band to
+//     request. If the module can't register on them, call
+//     NetworkCache_invalidate() so the next power up uses automatic
+//     network selection.
+//
+
+#ifndef NETWORKCACHE_H
+#define NETWORKCACHE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "CharString.h"
+#include "CharStringSpan.h"
+
+// enable/disable the cache. It doesn't fit in flash along with everything
+// else, so it's left out of normal builds. Without it the module always
+// uses automatic network selection
+#define NETWORKCACHE_ENABLED 0
+
+// numeric operator ids are 5 or 6 digits (MCC and MNC)
+#define NetworkCache_maxOperatorLength 6
+// the longest SIM800 band name is "GSM850_EGSM_DCS_PCS_MODE"
+#define NetworkCache_maxBandLength 24
+
+#if NETWORKCACHE_ENABLED
+extern bool NetworkCache_isValid (void);
+
+// NOTE: these functions APPEND to the given string
+extern void NetworkCache_getOperator (
+    CharString_t *oper);
+extern void NetworkCache_getBand (
+    CharString_t *band);
+
+// only writes to EEPROM if the operator or band has changed
+extern void NetworkCache_update (
+    const CharStringSpan_t *oper,
+    const CharStringSpan_t *band);
+
+extern void NetworkCache_invalidate (void);
+#else
+inline bool NetworkCache_isValid (void)
+{
+    return false;
+}
+
+inline void NetworkCache_getOperator (
+    CharString_t *oper) {}
+inline void NetworkCache_getBand (
+    CharString_t *band) {}
+
+inline void NetworkCache_update (
+    const CharStringSpan_t *oper,
+    const CharStringSpan_t *band) {}
+
+inline void NetworkCache_invalidate (void) {}
+#endif
+
+#endif  // NETWORKCACHE_H
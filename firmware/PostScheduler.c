@@ -0,0 +1,258 @@
+//
+//  Post Scheduler
+//
+//  The cost of an hour is a running average of how long its sessions
+//  took (in units of 2 seconds), with failed sessions counting as the
+//  highest cost. Erased EEPROM reads as NO_HOUR_COST (no sessions yet).
+//
+
+#include "PostScheduler.h"
+
+#include <avr/eeprom.h>
+#include "SystemTime.h"
+#include "SettingsShadow.h"
+#include "CellularComm_SIM800.h"
+#include "Console.h"
+#include "EEPROM_Util.h"
+
+static bool isLoggingSlot (
+    const uint32_t seconds)
+{
+    const uint16_t sampleInterval = SettingsShadow_sampleInterval();
+    const uint16_t logInterval = SettingsShadow_loggingUpdateInterval();
+    return ((seconds + (sampleInterval / 2)) % logInterval) < sampleInterval;
+}
+
+static uint32_t secondsUntilNextSlot (
+    const uint32_t seconds)
+{
+    const uint16_t sampleInterval = SettingsShadow_sampleInterval();
+    const uint16_t logInterval = SettingsShadow_loggingUpdateInterval();
+    return logInterval -
+        ((seconds + (sampleInterval / 2)) % logInterval);
+}
+
+#if POSTSCHEDULER_ENABLED
+
+// sessions are given up when the signal quality (CSQ) stays below this
+// for LOW_SIGNAL_GRACE_TIME seconds, or when the cell module hasn't
+// registered REGISTRATION_GIVE_UP_TIME seconds into the session
+#define MIN_SIGNAL_QUALITY 5
+#define LOW_SIGNAL_GRACE_TIME 10
+#define REGISTRATION_GIVE_UP_TIME 60
+// CSQ reported when the signal can't be measured
+#define UNKNOWN_SIGNAL_QUALITY 99
+
+// a failed post is retried one sample interval later, and each retry
+// after that waits twice as long as the one before
+#define MAX_BACKOFF_SHIFT 7
+
+// a scheduled post is only put off if the newest data on the server
+// would still be no older than this many logging intervals at the
+// next logging slot
+#define STALENESS_LIMIT_INTERVALS 3
+// an hour is avoided when its cost is more than this many eighths of
+// the average over the hours that have had sessions, once at least
+// MIN_HOURS_KNOWN hours have
+#define EXPENSIVE_HOUR_EIGHTHS 12
+#define MIN_HOURS_KNOWN 6
+
+#define NO_HOUR_COST 0xFF
+#define FAILED_SESSION_COST 254
+
+static uint8_t hourCost[24] EEMEM;
+
+// state variables
+static bool inSession;
+static SystemTime_t sessionStartTime;
+static bool lowSignalSeen;
+static SystemTime_t lowSignalTime;
+static uint8_t failures;
+static bool retryPending;
+static uint32_t retryTime;
+static bool haveUploaded;
+static uint32_t lastUploadTime;
+static uint8_t postsDeferred;
+
+static uint8_t hourOf (
+    const uint32_t seconds)
+{
+    return (seconds / 3600) % 24;
+}
+
+static bool hourIsExpensive (
+    const uint8_t hour)
+{
+    const uint8_t cost = EEPROM_read(&hourCost[hour]);
+    if (cost == NO_HOUR_COST) {
+        return false;
+    }
+    uint16_t totalCost = 0;
+    uint8_t hoursKnown = 0;
+    for (uint8_t h = 0; h < 24; ++h) {
+        const uint8_t c = EEPROM_read(&hourCost[h]);
+        if (c != NO_HOUR_COST) {
+            totalCost += c;
+            ++hoursKnown;
+        }
+    }
+    return (hoursKnown >= MIN_HOURS_KNOWN) &&
+        (((uint32_t)cost * hoursKnown * 8) >
+         ((uint32_t)totalCost * EXPENSIVE_HOUR_EIGHTHS));
+}
+
+static void updateHourCost (
+    const uint8_t hour,
+    const uint8_t sessionCost)
+{
+    const uint8_t oldCost = EEPROM_read(&hourCost[hour]);
+    const uint8_t newCost = (oldCost == NO_HOUR_COST)
+        ? sessionCost
+        : (uint8_t)((((uint16_t)oldCost * 3) + sessionCost + 2) / 4);
+    if (newCost != oldCost) {
+        EEPROM_write(&hourCost[hour], newCost);
+    }
+}
+
+bool PostScheduler_postIsDue (void)
+{
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    const uint32_t now = curTime.seconds;
+
+    if (retryPending && (now >= retryTime)) {
+        return true;
+    }
+    if (!isLoggingSlot(now)) {
+        return false;
+    }
+    if (retryPending || !haveUploaded) {
+        return true;
+    }
+    const uint32_t logInterval = SettingsShadow_loggingUpdateInterval();
+    const uint32_t ageAtNextSlot = (now - lastUploadTime) + logInterval;
+    if ((ageAtNextSlot <= (STALENESS_LIMIT_INTERVALS * logInterval)) &&
+        hourIsExpensive(hourOf(now))) {
+        Console_printP(PSTR("post deferred"));
+        if (postsDeferred < 255) {
+            ++postsDeferred;
+        }
+        return false;
+    }
+    return true;
+}
+
+uint32_t PostScheduler_secondsUntilNextPost (void)
+{
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    const uint32_t now = curTime.seconds;
+
+    const uint32_t untilSlot = secondsUntilNextSlot(now);
+    if (retryPending) {
+        const uint32_t untilRetry = (retryTime > now) ? (retryTime - now) : 0;
+        if (untilRetry < untilSlot) {
+            return untilRetry;
+        }
+    }
+    return untilSlot;
+}
+
+void PostScheduler_sessionStarted (void)
+{
+    SystemTime_getCurrentTime(&sessionStartTime);
+    lowSignalSeen = false;
+    inSession = true;
+}
+
+bool PostScheduler_shouldAbandonSession (void)
+{
+    if (!inSession) {
+        return false;
+    }
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+
+    if (!CellularComm_isRegistered()) {
+        return SystemTime_diffSec(&curTime, &sessionStartTime) >=
+            REGISTRATION_GIVE_UP_TIME;
+    }
+    if (!CellularComm_haveSignalQuality()) {
+        return false;
+    }
+    const uint8_t csq = CellularComm_SignalQuality();
+    if ((csq >= MIN_SIGNAL_QUALITY) && (csq != UNKNOWN_SIGNAL_QUALITY)) {
+        lowSignalSeen = false;
+        return false;
+    }
+    if (!lowSignalSeen) {
+        lowSignalSeen = true;
+        lowSignalTime = curTime;
+        return false;
+    }
+    return SystemTime_diffSec(&curTime, &lowSignalTime) >= LOW_SIGNAL_GRACE_TIME;
+}
+
+void PostScheduler_sessionEnded (
+    const bool uploaded)
+{
+    if (!inSession) {
+        return;
+    }
+    inSession = false;
+
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    const int32_t sessionSeconds =
+        SystemTime_diffSec(&curTime, &sessionStartTime);
+    uint8_t sessionCost = FAILED_SESSION_COST;
+    if (uploaded) {
+        sessionCost = (sessionSeconds >= (2L * (FAILED_SESSION_COST - 1)))
+            ? (FAILED_SESSION_COST - 1)
+            : (uint8_t)(sessionSeconds / 2);
+    }
+    updateHourCost(hourOf(sessionStartTime.seconds), sessionCost);
+
+    if (uploaded) {
+        failures = 0;
+        retryPending = false;
+        haveUploaded = true;
+        lastUploadTime = curTime.seconds;
+        postsDeferred = 0;
+    } else {
+        const uint32_t logInterval = SettingsShadow_loggingUpdateInterval();
+        uint32_t delay =
+            ((uint32_t)SettingsShadow_sampleInterval()) << failures;
+        if (delay > logInterval) {
+            delay = logInterval;
+        }
+        if (failures < MAX_BACKOFF_SHIFT) {
+            ++failures;
+        }
+        retryTime = curTime.seconds + delay;
+        retryPending = true;
+    }
+}
+
+uint8_t PostScheduler_postsDeferred (void)
+{
+    return postsDeferred;
+}
+
+#else
+
+bool PostScheduler_postIsDue (void)
+{
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    return isLoggingSlot(curTime.seconds);
+}
+
+uint32_t PostScheduler_secondsUntilNextPost (void)
+{
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    return secondsUntilNextSlot(curTime.seconds);
+}
+
+#endif  // POSTSCHEDULER_ENABLED
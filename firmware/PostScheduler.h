@@ -0,0 +1,65 @@
+//
+//  Post Scheduler
+//
+//  What it does:
+//     Decides when the monitor posts to the server. Posts are normally
+//     made every logging interval, but
+//      - a session is given up early when the cell module can't register
+//        or the signal is too weak to be worth trying,
+//      - a failed post is retried after a delay that doubles with each
+//        failure (up to the logging interval), instead of at the next
+//        logging slot,
+//      - a post is put off when it falls in an hour of the day whose
+//        sessions have been slow or have failed, as long as the data on
+//        the server won't get older than a few logging intervals.
+//     How well sessions go in each hour (UTC) is remembered in EEPROM.
+//
+//  How to use it:
+//     Each time the monitor wakes, ask PostScheduler_postIsDue(). Call
+//     PostScheduler_sessionStarted() when a session starts (including
+//     ones that aren't scheduled, such as level alerts), poll
+//     PostScheduler_shouldAbandonSession() while waiting for the
+//     connection, and call PostScheduler_sessionEnded() when the session
+//     is over.
+//
+
+#ifndef POSTSCHEDULER_H
+#define POSTSCHEDULER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// enable/disable everything but posting at each logging slot. It doesn't
+// fit in flash along with everything else, so it's left out of normal
+// builds
+#define POSTSCHEDULER_ENABLED 0
+
+extern bool PostScheduler_postIsDue (void);
+
+// seconds from now until the next post, scheduled or retry
+extern uint32_t PostScheduler_secondsUntilNextPost (void);
+
+#if POSTSCHEDULER_ENABLED
+extern void PostScheduler_sessionStarted (void);
+extern bool PostScheduler_shouldAbandonSession (void);
+extern void PostScheduler_sessionEnded (
+    const bool uploaded);
+
+// number of scheduled posts put off since the last successful upload
+extern uint8_t PostScheduler_postsDeferred (void);
+#else
+inline void PostScheduler_sessionStarted (void) {}
+inline bool PostScheduler_shouldAbandonSession (void)
+{
+    return false;
+}
+inline void PostScheduler_sessionEnded (
+    const bool uploaded) {}
+
+inline uint8_t PostScheduler_postsDeferred (void)
+{
+    return 0;
+}
+#endif
+
+#endif  // POSTSCHEDULER_H
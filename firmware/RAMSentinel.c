@@ -7,6 +7,15 @@
 //      still has the pattern. If the stack overflowed it will likely have a different
 //      value.
 //
+//      RAMSentinel_paintStack() runs before the C runtime initializes
+//      .data and .bss (from .init3) and fills the RAM from the end of static
+//      data to the top of the stack with STACK_PAINT. The stack grows down
+//      into this paint; RAMSentinel_checkStack() scans up from the end of
+//      static data to the lowest address found overwritten so far. a frame
+//      can skip over bytes it never writes, so no window just below the
+//      low-water mark is sure to catch a deeper excursion. the scan stops at
+//      the first overwritten byte, so it gets shorter as the stack grows.
+//
 
 #include "RAMSentinel.h"
 
@@ -15,12 +24,43 @@
 #include "avr/io.h"
 
 #define SENTINEL_VALUE 0xAA
+#define STACK_PAINT 0xC5
+
+// provided by the linker: end of .bss/.noinit, and the top of the stack
+extern uint8_t _end;
+extern uint8_t __stack;
 
 static uint8_t sentinel;
+static const uint8_t* stackLowWater;
+static uint8_t highWaterTaskID;
+
+void RAMSentinel_paintStack (void) __attribute__ ((naked, used, section (".init3")));
+void RAMSentinel_paintStack (void)
+{
+    // nothing is on the stack yet. volatile so that the compiler can't
+    // turn this into a call to memset, which would paint over its own
+    // return address
+    volatile uint8_t* p = &_end;
+    while (p <= &__stack) {
+        *p++ = STACK_PAINT;
+    }
+}
+
+// finds the lowest address that the stack has written to
+static const uint8_t* findStackLowWater (void)
+{
+    const uint8_t* p = &_end;
+    while ((p <= &__stack) && (*p == STACK_PAINT)) {
+        ++p;
+    }
+    return p;
+}
 
 void RAMSentinel_Initialize (void)
 {
     sentinel = SENTINEL_VALUE;
+    stackLowWater = findStackLowWater();
+    highWaterTaskID = 0;
 }
 
 bool RAMSentinel_sentinelIntact (void)
@@ -43,3 +83,31 @@ void RAMSentinel_printStackPtr (void)
     CharString_appendC('>', &msg);
     Console_printCS(&msg);
 }
+
+void RAMSentinel_checkStack (
+    const uint8_t taskID)
+{
+    const uint8_t* p = &_end;
+    while ((p < stackLowWater) && (*p == STACK_PAINT)) {
+        ++p;
+    }
+    if (p < stackLowWater) {
+        stackLowWater = p;
+        highWaterTaskID = taskID;
+    }
+}
+
+uint16_t RAMSentinel_stackHighWater (void)
+{
+    return (&__stack - stackLowWater) + 1;
+}
+
+uint16_t RAMSentinel_freeMargin (void)
+{
+    return stackLowWater - &_end;
+}
+
+uint8_t RAMSentinel_highWaterTaskID (void)
+{
+    return highWaterTaskID;
+}
@@ -6,6 +6,11 @@
 //     This module should be last in the list of objects so the linker
 //     places its memory at the end of RAM
 //
+//     Also measures how deep the stack has gone: the RAM between the end
+//     of .bss/.noinit and the top of the stack is painted with a known
+//     pattern at startup, and the lowest address that no longer holds the
+//     pattern is the stack's high-water mark.
+//
 
 #ifndef RAMSENTINEL_H
 #define RAMSENTINEL_H
@@ -23,4 +28,22 @@ extern bool RAMSentinel_sentinelIntact (void);
 
 extern void RAMSentinel_printStackPtr (void);
 
+// checks for a stack excursion deeper than any seen so far. call after
+// each task, with an ID for the task, so that the deepest excursion can be
+// attributed to it. (an interrupt taken while the task was running is
+// counted as part of the task)
+extern void RAMSentinel_checkStack (
+    const uint8_t taskID);
+
+// deepest the stack has been since startup, in bytes
+extern uint16_t RAMSentinel_stackHighWater (void);
+
+// bytes between the end of static data and the deepest the stack has
+// been, i.e. RAM that has never been used
+extern uint16_t RAMSentinel_freeMargin (void);
+
+// ID of the task that was running when the stack was deepest
+// (0 if that was during initialization)
+extern uint8_t RAMSentinel_highWaterTaskID (void);
+
 #endif      /* RAMSENTINEL_H */
@@ -0,0 +1,155 @@
+//
+//  Reply Writer
+//
+//  Streams command replies to their destination
+//
+
+#include "ReplyWriter.h"
+
+#include <avr/wdt.h>
+#include "SystemTime.h"
+#include "StringUtils.h"
+#include "EEPROM_Util.h"
+
+// how long to wait for a stream destination that isn't draining
+// before the rest of the reply is dropped. units are 1/100 sec
+#define STALL_TIMEOUT 200
+
+void ReplyWriter_initForString (
+    CharString_t *str,
+    ReplyWriter_t *writer)
+{
+    writer->availableSpace = 0;
+    writer->write = 0;
+    writer->string = str;
+    writer->length = 0;
+}
+
+void ReplyWriter_initForStream (
+    ReplyWriter_SpaceFunction availableSpace,
+    ReplyWriter_WriteFunction write,
+    ReplyWriter_t *writer)
+{
+    writer->availableSpace = availableSpace;
+    writer->write = write;
+    writer->string = 0;
+    writer->length = 0;
+}
+
+void ReplyWriter_initNull (
+    ReplyWriter_t *writer)
+{
+    ReplyWriter_initForStream(0, 0, writer);
+}
+
+void ReplyWriter_writeC (
+    const char ch,
+    ReplyWriter_t *writer)
+{
+    const CharStringSpan_t chSpan = {&ch, (&ch) + 1};
+    ReplyWriter_writeCSS(&chSpan, writer);
+}
+
+void ReplyWriter_writeP (
+    PGM_P text,
+    ReplyWriter_t *writer)
+{
+    // copy text out of program memory a piece at a time
+    CharString_define(16, piece);
+    uint8_t pieceLength;
+    do {
+        strncpy_P(CharString_buffer(&piece), text, 16);
+        piece.body[16] = 0;
+        pieceLength = strlen(CharString_buffer(&piece));
+        piece.length = pieceLength;
+        ReplyWriter_writeCS(&piece, writer);
+        text += pieceLength;
+    } while (pieceLength == 16);
+}
+
+void ReplyWriter_writeCS (
+    const CharString_t *text,
+    ReplyWriter_t *writer)
+{
+    CharStringSpan_t textSpan;
+    CharStringSpan_init(text, &textSpan);
+    ReplyWriter_writeCSS(&textSpan, writer);
+}
+
+void ReplyWriter_writeCSS (
+    const CharStringSpan_t *text,
+    ReplyWriter_t *writer)
+{
+    writer->length += CharStringSpan_length(text);
+
+    if (writer->string != 0) {
+        for (CharString_Iter iter = CharStringSpan_begin(text);
+            iter != CharStringSpan_end(text); ++iter) {
+            CharString_appendC(*iter, writer->string);
+        }
+    } else if (writer->write != 0) {
+        CharStringSpan_t remaining = *text;
+        SystemTime_t stallTime;
+        SystemTime_futureTime(STALL_TIMEOUT, &stallTime);
+        while (!CharStringSpan_isEmpty(&remaining)) {
+            const uint16_t availableSpace = writer->availableSpace();
+            if (availableSpace > 0) {
+                CharStringSpan_t chunk;
+                CharStringSpan_extractLeft(
+                    (availableSpace > 255) ? 255 : availableSpace,
+                    &remaining, &chunk);
+                writer->write(&chunk);
+                SystemTime_futureTime(STALL_TIMEOUT, &stallTime);
+            } else if (SystemTime_shuttingDown() ||
+                       SystemTime_timeHasArrived(&stallTime)) {
+                // destination isn't draining. drop the rest
+                break;
+            } else {
+                // wait for the destination to drain. the main loop
+                // isn't running while we wait, so keep the watchdog
+                // happy here
+                wdt_reset();
+            }
+        }
+    }
+}
+
+void ReplyWriter_writeEEPROMString (
+    const char *eeText,
+    ReplyWriter_t *writer)
+{
+    // copy text out of EEPROM a piece at a time
+    CharString_define(16, piece);
+    uint8_t* charAddr = (uint8_t*)eeText;
+    char ch;
+    do {
+        CharString_clear(&piece);
+        while ((CharString_length(&piece) < 16) &&
+               ((ch = EEPROM_read(charAddr++)) != 0)) {
+            CharString_appendC(ch, &piece);
+        }
+        ReplyWriter_writeCS(&piece, writer);
+    } while (CharString_length(&piece) == 16);
+}
+
+void ReplyWriter_writeDecimal (
+    const int16_t value,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    ReplyWriter_t *writer)
+{
+    CharString_define(16, decimal);
+    StringUtils_appendDecimal(value, minIntegerDigits, numFractionalDigits, &decimal);
+    ReplyWriter_writeCS(&decimal, writer);
+}
+
+void ReplyWriter_writeDecimal32 (
+    const int32_t value,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    ReplyWriter_t *writer)
+{
+    CharString_define(16, decimal);
+    StringUtils_appendDecimal32(value, minIntegerDigits, numFractionalDigits, &decimal);
+    ReplyWriter_writeCS(&decimal, writer);
+}
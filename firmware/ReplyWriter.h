@@ -0,0 +1,96 @@
+//
+//  Reply Writer
+//
+//  What it does:
+//    Streams command replies to their destination (TCP/IP connection,
+//    console, SMS text) as they are generated, instead of assembling
+//    them in a fixed-size buffer first. Replies therefore have no size
+//    ceiling other than that of the destination.
+//    Stream destinations apply back-pressure: when the destination's
+//    output queue is full the writer waits for it to drain.
+//
+//  How to use it:
+//    Initialize a writer for the destination, for example:
+//       ReplyWriter_t reply;
+//       ReplyWriter_initForStream(
+//           CellularTCPIP_availableSpaceForWriteData,
+//           CellularTCPIP_writeDataCSS,
+//           &reply);
+//    and pass it to CommandProcessor_executeCommand
+//
+#ifndef REPLYWRITER_H
+#define REPLYWRITER_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+#include "CharStringSpan.h"
+
+// prototypes for functions that stream destinations supply
+typedef uint16_t (*ReplyWriter_SpaceFunction)(void);
+typedef void (*ReplyWriter_WriteFunction)(
+    const CharStringSpan_t *text);
+
+typedef struct ReplyWriter_struct {
+    ReplyWriter_SpaceFunction availableSpace;
+    ReplyWriter_WriteFunction write;
+    CharString_t *string;
+    uint16_t length;    // number of chars written so far
+} ReplyWriter_t;
+
+// writer appends to the given string
+extern void ReplyWriter_initForString (
+    CharString_t *str,
+    ReplyWriter_t *writer);
+
+// writer streams to the given destination
+extern void ReplyWriter_initForStream (
+    ReplyWriter_SpaceFunction availableSpace,
+    ReplyWriter_WriteFunction write,
+    ReplyWriter_t *writer);
+
+// writer only counts what is written to it
+extern void ReplyWriter_initNull (
+    ReplyWriter_t *writer);
+
+inline uint16_t ReplyWriter_length (
+    const ReplyWriter_t *writer)
+{
+    return writer->length;
+}
+
+extern void ReplyWriter_writeC (
+    const char ch,
+    ReplyWriter_t *writer);
+
+extern void ReplyWriter_writeP (
+    PGM_P text,
+    ReplyWriter_t *writer);
+
+extern void ReplyWriter_writeCS (
+    const CharString_t *text,
+    ReplyWriter_t *writer);
+
+extern void ReplyWriter_writeCSS (
+    const CharStringSpan_t *text,
+    ReplyWriter_t *writer);
+
+// writes the null-terminated string at the given EEPROM address
+extern void ReplyWriter_writeEEPROMString (
+    const char *eeText,
+    ReplyWriter_t *writer);
+
+// writes the decimal string for the given value
+// (see StringUtils_appendDecimal)
+extern void ReplyWriter_writeDecimal (
+    const int16_t value,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    ReplyWriter_t *writer);
+extern void ReplyWriter_writeDecimal32 (
+    const int32_t value,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    ReplyWriter_t *writer);
+
+#endif  // REPLYWRITER_H
@@ -20,8 +20,14 @@
 #include "Console.h"
 #include "SystemTime.h"
 #include "StringUtils.h"
+#include "ScratchArena.h"
+#include "ATLatency.h"
 
 #define USE_POWER_STATE 0
+// power down with AT+CPOWD=1, falling back to the power key if the module
+// doesn't report NORMAL POWER DOWN within CPOWD_TIMEOUT hundredths
+#define USE_CPOWD 1
+#define CPOWD_TIMEOUT 150
 #define DEBUG_TRACE 0
 
 #define TX_CHAN_INDEX 0
@@ -73,15 +79,20 @@ PGM_P SIM800_ResponseMessageTable[] PROGMEM =
 static const int SIM800_ResponseMessageTableSize = sizeof(SIM800_ResponseMessageTable) / sizeof(PGM_P);
 
 typedef enum PlusMessage_enum {
+    pm_CBAND,
     pm_CBC,
     pm_CCLK,
+    pm_CDNSGIP,
     pm_CFUN,
     pm_CGATT,
     pm_CIPACK,
+    pm_CIPHEAD,
+    pm_CIPQSEND,
     pm_CMGL,
     pm_CMGR,
     pm_CMGS,
     pm_CMTI,
+    pm_COPS,
     pm_CPIN,
     pm_CREG,
     pm_CSQ,
@@ -89,15 +100,20 @@ typedef enum PlusMessage_enum {
     pm_unrecognized
 } PlusMessage;
 
+char pmCBAND[]  PROGMEM = "CBAND";
 char pmCBC[]    PROGMEM = "CBC";
 char pmCCLK[]   PROGMEM = "CCLK";
+char pmCDNSGIP[] PROGMEM = "CDNSGIP";
 char pmCFUN[]   PROGMEM = "CFUN";
 char pmCGATT[]  PROGMEM = "CGATT";
 char pmCIPACK[] PROGMEM = "CIPACK";
+char pmCIPHEAD[] PROGMEM = "CIPHEAD";
+char pmCIPQSEND[] PROGMEM = "CIPQSEND";
 char pmCMGL[]   PROGMEM = "CMGL";
 char pmCMGR[]   PROGMEM = "CMGR";
 char pmCMGS[]   PROGMEM = "CMGS";
 char pmCMTI[]   PROGMEM = "CMTI";
+char pmCOPS[]   PROGMEM = "COPS";
 char pmCPIN[]   PROGMEM = "CPIN";
 char pmCREG[]   PROGMEM = "CREG";
 char pmCSQ[]    PROGMEM = "CSQ";
@@ -107,15 +123,20 @@ char pmPDP []   PROGMEM = "PDP";
 // in sync with PlusMessage enum
 PGM_P plusMessageTable[] PROGMEM = 
 {
+    pmCBAND,
     pmCBC,
     pmCCLK,
+    pmCDNSGIP,
     pmCFUN,
     pmCGATT,
     pmCIPACK,
+    pmCIPHEAD,
+    pmCIPQSEND,
     pmCMGL,
     pmCMGR,
     pmCMGS,
     pmCMTI,
+    pmCOPS,
     pmCPIN,
     pmCREG,
     pmCSQ,
@@ -171,6 +192,7 @@ typedef enum moduleStateEnum {
     ms_waitingForCommand,
     ms_executingCommand,
     ms_powerRetryDelay,
+    ms_waitingForPowerDownResponse
 } ModuleState;
 
 static bool powerCommand;
@@ -198,11 +220,16 @@ static SIM800_PDPDeactCallback pdpDeactCallback;
 static SIM800_CGATTCallback cgattCallback;
 static SIM800_SMSMessageReceivedCallback smsMessageReceivedCallback;
 static SIM800_CFUNCallback CFUNCallback;
+static SIM800_CIPHEADCallback CIPHEADCallback;
+static SIM800_CIPQSENDCallback CIPQSENDCallback;
 static SIM800_CSQCallback CSQCallback;
 static SIM800_CREGCallback CREGCallback;
 static SIM800_CMTICallback CMTICallback;
 static SIM800_CPINCallback CPINCallback;
 static SIM800_CCLKCallback CCLKCallback;
+static SIM800_CDNSGIPCallback CDNSGIPCallback;
+static SIM800_COPSCallback COPSCallback;
+static SIM800_CBANDCallback CBANDCallback;
 static SIM800_CBCCallback CBCCallback;
 static SIM800_promptCallback promptCallback;
 
@@ -287,6 +314,30 @@ static void readCFUN (
     }
 }
 
+static void readCIPHEAD (
+    CharStringSpan_t *str)
+{
+    StringUtils_skipWhitespace(str);
+    bool isValid;
+    int16_t mode;
+    StringUtils_scanInteger(str, &isValid, &mode, NULL);
+    if (isValid && (CIPHEADCallback != 0)) {
+        CIPHEADCallback(mode);
+    }
+}
+
+static void readCIPQSEND (
+    CharStringSpan_t *str)
+{
+    StringUtils_skipWhitespace(str);
+    bool isValid;
+    int16_t mode;
+    StringUtils_scanInteger(str, &isValid, &mode, NULL);
+    if (isValid && (CIPQSENDCallback != 0)) {
+        CIPQSENDCallback(mode);
+    }
+}
+
 static void readCGATT (
     CharStringSpan_t *str)
 {
@@ -407,6 +458,66 @@ static void readCMTI (
     }
 }
 
+// "+CDNSGIP: 1,"<domain>","<IP1>"[,"<IP2>"]" if the name was resolved,
+// or "+CDNSGIP: 0,<error code>" if it wasn't
+static void readCDNSGIP (
+    CharStringSpan_t *str)
+{
+    bool isValid;
+    int16_t resolved;
+    CharStringSpan_t addressStr;
+    CharStringSpan_clear(&addressStr);
+    StringUtils_skipWhitespace(str);
+    StringUtils_scanInteger(str, &isValid, &resolved, str);
+    if (isValid && (resolved == 1)) {
+        // skip the domain name
+        CharStringSpan_t domainStr;
+        StringUtils_scanQuotedString(str, &domainStr, str);
+        StringUtils_scanQuotedString(str, &addressStr, NULL);
+    }
+
+    ATLatency_resultReceived();
+    if (CDNSGIPCallback != 0) {
+        CDNSGIPCallback(!CharStringSpan_isEmpty(&addressStr), &addressStr);
+    }
+}
+
+// "+COPS: <mode>,<format>,"<oper>"". there is no operator if the module
+// isn't registered
+static void readCOPS (
+    CharStringSpan_t *str)
+{
+    CharStringSpan_t operStr;
+    StringUtils_scanQuotedString(str, &operStr, NULL);
+
+    if ((!CharStringSpan_isEmpty(&operStr)) && (COPSCallback != 0)) {
+        COPSCallback(&operStr);
+    }
+}
+
+// "+CBAND: <band>". the band may be quoted, and may be followed by
+// a list of other bands the module supports
+static void readCBAND (
+    CharStringSpan_t *str)
+{
+    CharStringSpan_t bandStr;
+    StringUtils_skipWhitespace(str);
+    if (CharStringSpan_front(str) == '"') {
+        StringUtils_scanQuotedString(str, &bandStr, NULL);
+    } else {
+        CharString_Iter iter = CharStringSpan_begin(str);
+        const CharString_Iter end = CharStringSpan_end(str);
+        while ((iter != end) && (*iter != ',')) {
+            ++iter;
+        }
+        CharStringSpan_set(CharStringSpan_begin(str), iter, &bandStr);
+    }
+
+    if ((!CharStringSpan_isEmpty(&bandStr)) && (CBANDCallback != 0)) {
+        CBANDCallback(&bandStr);
+    }
+}
+
 static void readCPIN (
     CharStringSpan_t *str)
 {
@@ -418,6 +529,8 @@ static void readCPIN (
     }
 }
 
+// reads both the response to AT+CREG? ("+CREG: <n>,<stat>") and the
+// unsolicited report enabled by AT+CREG=1 ("+CREG: <stat>")
 static void readCREG (
     CharStringSpan_t *str)
 {
@@ -428,18 +541,18 @@ static void readCREG (
     if (isValid && (CharStringSpan_front(str) == ',')) {
         CharStringSpan_incrBegin(str);   // step over ','
         StringUtils_scanInteger(str, &isValid, &reg, NULL);
-        if (isValid) {
+    }
+    if (isValid) {
 
 #if DEBUG_TRACE
-            CharString_define(10, msgstr);
-            CharString_copyP(PSTR("Reg: "), &msgstr);
-            StringUtils_appendDecimal(reg, 1, 0, &msgstr);
-            Console_printCS(&msgstr);
+        CharString_define(10, msgstr);
+        CharString_copyP(PSTR("Reg: "), &msgstr);
+        StringUtils_appendDecimal(reg, 1, 0, &msgstr);
+        Console_printCS(&msgstr);
 #endif
 
-            if (CREGCallback != 0) {
-                CREGCallback(reg);
-            }
+        if (CREGCallback != 0) {
+            CREGCallback(reg);
         }
     }
 }
@@ -487,16 +600,21 @@ static void processPlusMessage (
         &msg, plusMessageTable, plusMessageTableSize);
     latestPlusMessage = ((PlusMessage)msgIndex);
     switch (latestPlusMessage) {
+        case pm_CBAND   : readCBAND(plusMsg);   break;
         case pm_CBC     : readCBC(plusMsg);     break;
         case pm_CCLK    : readCCLK(plusMsg);    break;
+        case pm_CDNSGIP : readCDNSGIP(plusMsg); break;
         case pm_CFUN    : readCFUN(plusMsg);    break;
         case pm_CGATT   : readCGATT(plusMsg);   break;
         case pm_CIPACK  : readCIPACK(plusMsg);  break;
+        case pm_CIPHEAD : readCIPHEAD(plusMsg); break;
+        case pm_CIPQSEND: readCIPQSEND(plusMsg); break;
         case pm_CMGL    : readCMGL(plusMsg);    break;
         case pm_CMGR    : smsMsgID = 0;
                           readCMGR(plusMsg);    break;
         case pm_CMGS    : readCMGS(plusMsg);    break;
         case pm_CMTI    : readCMTI(plusMsg);    break;
+        case pm_COPS    : readCOPS(plusMsg);    break;
         case pm_CPIN    : readCPIN(plusMsg);    break;
         case pm_CREG    : readCREG(plusMsg);    break;
         case pm_CSQ     : readCSQ(plusMsg);     break;
@@ -567,6 +685,7 @@ static void processResponseMessage (
         case rm_noResponseYet       :
             break;
     }
+    ATLatency_responseReceived(responseMsg);
     if (responseCallback != 0) {
         responseCallback(responseMsg);
     }
@@ -588,6 +707,7 @@ static void interpretResponse (
             Console_printP(PSTR("Got TCP/IP address: "));
             Console_printCS(response);
 #endif
+            ATLatency_resultReceived();
             if (ipAddressCallback != 0) {
                 ipAddressCallback(response);
             }
@@ -598,6 +718,7 @@ static void interpretResponse (
             processIPState(&ipStateStr);
         } else if ((firstChar == 'D') && 
                    CharString_startsWithP(response, PSTR("DATA ACCEPT:"))) {
+            ATLatency_resultReceived();
             if (dataAcceptCallback != 0) {
                 dataAcceptCallback(0);  // TODO: need to read number
             }
@@ -665,11 +786,13 @@ static void processResponseBytes (void)
 
 #if DEBUG_TRACE
                     // limit console print message to 65 chars
-                    CharString_define(65, msg);
+                    const ScratchArena_Mark mark = ScratchArena_mark();
+                    ScratchArena_defineString(65, msg);
                     CharString_copyP(PSTR("SIM800: '"), &msg);
                     CharString_appendCS(&SIM800Response, &msg);
                     CharString_appendC('\'', &msg);
                     Console_printCS(&msg);
+                    ScratchArena_release(mark);
 #endif
 
                     interpretResponse(&SIM800Response);
@@ -765,6 +888,17 @@ void SIM800_powerOff (void)
     powerCommand = false;
 }
 
+void SIM800_assumePowerState (
+    const bool poweredOn)
+{
+    // used when the module's power state is known without asking it, such
+    // as after waking from AVR sleep with the module left in CSCLK sleep
+    powerCommand = poweredOn;
+    mState = poweredOn
+        ? ms_waitingForCommand
+        : ms_off;
+}
+
 void SIM800_Initialize (
     ByteQueue_t *rxQ,
     IOPortBitfield_PortSelection txPort,
@@ -801,11 +935,16 @@ void SIM800_Initialize (
     cgattCallback = 0;
     smsMessageReceivedCallback = 0;
     CFUNCallback = 0;
+    CIPHEADCallback = 0;
+    CIPQSENDCallback = 0;
     CSQCallback = 0;
     CREGCallback = 0;
     CMTICallback = 0;
     CPINCallback = 0;
     CCLKCallback = 0;
+    CDNSGIPCallback = 0;
+    COPSCallback = 0;
+    CBANDCallback = 0;
     CBCCallback = 0;
     promptCallback = 0;
 
@@ -867,6 +1006,25 @@ void SIM800_task (void)
         case ms_waitingForCommand :
             if (!powerCommand) {
                 responseMsg = rm_noResponseYet;
+#if USE_CPOWD
+                SIM800_sendLineP(PSTR("AT+CPOWD=1"));
+                SystemTime_futureTime(CPOWD_TIMEOUT, &powerRetryTime);
+                mState = ms_waitingForPowerDownResponse;
+#else
+                assertOnKey();
+                mState = ms_waitingForPowerStateResponse;
+#endif
+            }
+            break;
+        case ms_waitingForPowerDownResponse :
+            if (responseMsg == rm_NORMAL_POWER_DOWN) {
+#if DEBUG_TRACE
+                Console_printP(PSTR("--- Off ---"));
+#endif
+                mState = ms_off;
+            } else if (SystemTime_timeHasArrived(&powerRetryTime)) {
+                // the module didn't power down. use the power key
+                responseMsg = rm_noResponseYet;
                 assertOnKey();
                 mState = ms_waitingForPowerStateResponse;
             }
@@ -907,6 +1065,9 @@ SIM800_moduleStatus SIM800_status (void)
         case ms_off :
             status = SIM800_ms_off;
             break;
+        case ms_waitingForPowerDownResponse :
+            status = SIM800_ms_poweringDown;
+            break;
         case ms_waitingForPowerStateResponse :
         case ms_powerRetryDelay :
             status = powerCommand
@@ -984,6 +1145,18 @@ void SIM800_setCFUNCallback (
     CFUNCallback = cb;
 }
 
+void SIM800_setCIPHEADCallback (
+    SIM800_CIPHEADCallback cb)
+{
+    CIPHEADCallback = cb;
+}
+
+void SIM800_setCIPQSENDCallback (
+    SIM800_CIPQSENDCallback cb)
+{
+    CIPQSENDCallback = cb;
+}
+
 void SIM800_setCSQCallback (
     SIM800_CSQCallback cb)
 {
@@ -1014,6 +1187,24 @@ void SIM800_setCCLKCallback (
     CCLKCallback = cb;
 }
 
+void SIM800_setCDNSGIPCallback (
+    SIM800_CDNSGIPCallback cb)
+{
+    CDNSGIPCallback = cb;
+}
+
+void SIM800_setCOPSCallback (
+    SIM800_COPSCallback cb)
+{
+    COPSCallback = cb;
+}
+
+void SIM800_setCBANDCallback (
+    SIM800_CBANDCallback cb)
+{
+    CBANDCallback = cb;
+}
+
 void SIM800_setCBCCallback (
     SIM800_CBCCallback cb)
 {
@@ -96,6 +96,11 @@ typedef void (*SIM800_SMSMessageReceivedCallback)(
     const CharString_t *message);
 typedef void (*SIM800_CFUNCallback)(
     const int16_t funclevel);
+// responses to AT+CIPHEAD? and AT+CIPQSEND?
+typedef void (*SIM800_CIPHEADCallback)(
+    const int16_t mode);
+typedef void (*SIM800_CIPQSENDCallback)(
+    const int16_t mode);
 typedef void (*SIM800_CSQCallback)(
     const int16_t sigStrength);
 typedef void (*SIM800_CREGCallback)(
@@ -106,6 +111,16 @@ typedef void (*SIM800_CPINCallback)(
     const CharStringSpan_t *cpinStatus);
 typedef void (*SIM800_CCLKCallback)(
     const SIM800_NetworkTime *time);
+// result of AT+CDNSGIP. address is the first IP address the name
+// resolved to, and is empty if it couldn't be resolved
+typedef void (*SIM800_CDNSGIPCallback)(
+    const bool resolved,
+    const CharStringSpan_t *address);
+// operator is in the format last set with AT+COPS=3
+typedef void (*SIM800_COPSCallback)(
+    const CharStringSpan_t *oper);
+typedef void (*SIM800_CBANDCallback)(
+    const CharStringSpan_t *band);
 typedef void (*SIM800_CBCCallback)(
     const uint8_t chargeStatus,
     const uint8_t percent,
@@ -122,6 +137,9 @@ extern void SIM800_task (void);
 
 extern void SIM800_powerOn (void);
 extern void SIM800_powerOff (void);
+// sets the power state without toggling the power key
+extern void SIM800_assumePowerState (
+    const bool poweredOn);
 
 extern SIM800_moduleStatus SIM800_status (void);
 
@@ -145,6 +163,10 @@ extern void SIM800_setSMSMessageReceivedCallback (
     SIM800_SMSMessageReceivedCallback cb);
 extern void SIM800_setCFUNCallback (
     SIM800_CFUNCallback cb);
+extern void SIM800_setCIPHEADCallback (
+    SIM800_CIPHEADCallback cb);
+extern void SIM800_setCIPQSENDCallback (
+    SIM800_CIPQSENDCallback cb);
 extern void SIM800_setCSQCallback (
     SIM800_CSQCallback cb);
 extern void SIM800_setCREGCallback (
@@ -155,6 +177,12 @@ extern void SIM800_setCPINCallback (
     SIM800_CPINCallback cb);
 extern void SIM800_setCCLKCallback (
     SIM800_CCLKCallback cb);
+extern void SIM800_setCDNSGIPCallback (
+    SIM800_CDNSGIPCallback cb);
+extern void SIM800_setCOPSCallback (
+    SIM800_COPSCallback cb);
+extern void SIM800_setCBANDCallback (
+    SIM800_CBANDCallback cb);
 extern void SIM800_setCBCCallback (
     SIM800_CBCCallback cb);
 extern void SIM800_setPromptCallback (
@@ -27,6 +27,16 @@ void SampleHistory_insertSample (
     }
 }
 
+void SampleHistory_removeOldest (
+    const uint8_t numSamples,
+    SampleHistory_t* sampleHistory)
+{
+    // the tail stays put, so the samples that remain keep their places
+    sampleHistory->length = (numSamples < sampleHistory->length)
+        ? (sampleHistory->length - numSamples)
+        : 0;
+}
+
 const SampleHistory_Sample* SampleHistory_getAt (
     const uint8_t at,
     SampleHistory_t* sampleHistory)
@@ -40,6 +40,11 @@ extern void SampleHistory_insertSample (
     const SampleHistory_Sample* sample,
     SampleHistory_t* sampleHistory);
 
+// removes the given number of samples, oldest first
+extern void SampleHistory_removeOldest (
+    const uint8_t numSamples,
+    SampleHistory_t* sampleHistory);
+
 extern const SampleHistory_Sample* SampleHistory_getAt (
     const uint8_t at,  // 0 to length-1, 0 is oldest
     SampleHistory_t* sampleHistory);
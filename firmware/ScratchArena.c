@@ -0,0 +1,93 @@
+//
+//  Scratch Arena
+//
+//  Task scratch grows up from the bottom of the arena, phase buffers grow
+//  down from the top, and an allocation fails when they would meet.
+//
+
+#include "ScratchArena.h"
+
+static char arena[SCRATCH_ARENA_SIZE];
+static ScratchArena_Mark scratchTop;    // first free byte above task scratch
+static ScratchArena_Mark phaseBottom;   // lowest byte used by phase buffers
+
+// body for strings that have no capacity
+static char emptyBody[1];
+
+static void setUpString (
+    char *body,
+    const uint8_t capacity,
+    CharString_t *str)
+{
+    str->capacity = capacity;
+    str->length = 0;
+    str->body = body;
+    body[0] = 0;
+}
+
+void ScratchArena_Initialize (void)
+{
+    scratchTop = 0;
+    phaseBottom = SCRATCH_ARENA_SIZE;
+}
+
+ScratchArena_Mark ScratchArena_mark (void)
+{
+    return scratchTop;
+}
+
+void ScratchArena_release (
+    const ScratchArena_Mark mark)
+{
+    scratchTop = mark;
+}
+
+void ScratchArena_releaseTaskScratch (void)
+{
+    scratchTop = 0;
+}
+
+bool ScratchArena_allocString (
+    const uint8_t capacity,
+    CharString_t *str)
+{
+    // capacity + 1 for the terminating 0
+    if ((phaseBottom - scratchTop) <= capacity) {
+        ScratchArena_initEmptyString(str);
+        return false;
+    }
+    setUpString(&arena[scratchTop], capacity, str);
+    scratchTop += capacity + 1;
+    return true;
+}
+
+ScratchArena_Mark ScratchArena_phaseMark (void)
+{
+    return phaseBottom;
+}
+
+void ScratchArena_releasePhase (
+    const ScratchArena_Mark mark)
+{
+    phaseBottom = mark;
+}
+
+bool ScratchArena_allocPhaseString (
+    const uint8_t capacity,
+    CharString_t *str)
+{
+    // capacity + 1 for the terminating 0
+    if ((phaseBottom - scratchTop) <= capacity) {
+        ScratchArena_initEmptyString(str);
+        return false;
+    }
+    phaseBottom -= capacity + 1;
+    setUpString(&arena[phaseBottom], capacity, str);
+    return true;
+}
+
+void ScratchArena_initEmptyString (
+    CharString_t *str)
+{
+    setUpString(emptyBody, 0, str);
+}
@@ -0,0 +1,71 @@
+//
+//  Scratch Arena
+//
+//  What it does:
+//     Hands out string buffers from one shared block of RAM to data that
+//     is only needed some of the time, so that buffers that are never in
+//     use at the same time don't each hold RAM of their own.
+//
+//     Task scratch is allocated from the bottom of the arena and only
+//     lasts for one call of a task: the main loop releases all of it
+//     after each task returns. It replaces large CharString_define
+//     buffers on the stack.
+//     Phase buffers are allocated from the top of the arena and hold data
+//     across task calls for the duration of one activity (such as handling
+//     an SMS message). The owner releases them when the activity is over.
+//
+//  How to use it:
+//     For task scratch use ScratchArena_defineString() in place of
+//     CharString_define(). Wrap allocations made in a loop in
+//     ScratchArena_mark()/ScratchArena_release().
+//     For a phase, take ScratchArena_phaseMark() when it starts, allocate
+//     with ScratchArena_allocPhaseString(), and when it ends call
+//     ScratchArena_initEmptyString() on its strings and then
+//     ScratchArena_releasePhase().
+//     An allocation fails when the arena is full, leaving the string with
+//     no capacity (it stays empty). Callers have to check, and put off the
+//     work until a later call.
+//
+
+#ifndef SCRATCHARENA_H
+#define SCRATCHARENA_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "CharString.h"
+
+// room for both SMS message texts plus a little task scratch
+#define SCRATCH_ARENA_SIZE 176
+
+typedef uint8_t ScratchArena_Mark;
+
+extern void ScratchArena_Initialize (void);
+
+// task scratch
+extern ScratchArena_Mark ScratchArena_mark (void);
+extern void ScratchArena_release (
+    const ScratchArena_Mark mark);
+// releases all task scratch. called by the main loop after each task
+extern void ScratchArena_releaseTaskScratch (void);
+// returns false if there isn't room for a string of the given capacity
+extern bool ScratchArena_allocString (
+    const uint8_t capacity,
+    CharString_t *str);
+
+#define ScratchArena_defineString(strCapacity, strName) \
+    CharString_t strName; \
+    ScratchArena_allocString(strCapacity, &strName);
+
+// phase buffers
+extern ScratchArena_Mark ScratchArena_phaseMark (void);
+extern void ScratchArena_releasePhase (
+    const ScratchArena_Mark mark);
+extern bool ScratchArena_allocPhaseString (
+    const uint8_t capacity,
+    CharString_t *str);
+
+// gives str no capacity and an empty body that isn't in the arena
+extern void ScratchArena_initEmptyString (
+    CharString_t *str);
+
+#endif  // SCRATCHARENA_H
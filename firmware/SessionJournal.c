@@ -0,0 +1,193 @@
+//
+//  Session Journal
+//
+//  The slot to write next isn't stored, since it would be rewritten after
+//  every session and wear out long before the entries do. Instead each
+//  entry carries a sequence number, and the newest entry is the one that
+//  the entry after it in the ring doesn't follow in sequence.
+//
+
+#include "SessionJournal.h"
+
+#if SESSIONJOURNAL_ENABLED
+
+#include <avr/eeprom.h>
+#include "SystemTime.h"
+#include "EEPROM_Util.h"
+
+static SessionJournal_Entry journal[SessionJournal_numEntries] EEMEM;
+
+// the entry of the session in progress
+static SessionJournal_Entry current;
+static bool inSession;
+static bool uploaded;
+// phases that were marked in this session (bit per phase)
+static uint8_t phasesMarked;
+static SystemTime_t phaseStartTime;
+
+// location in the ring, found the first time it is needed
+static bool haveLocatedNewest;
+static uint8_t nextSlot;
+static uint8_t nextSeq;
+
+static uint8_t storedOutcome (
+    const uint8_t slot)
+{
+    return EEPROM_read(&journal[slot].outcome);
+}
+
+static uint8_t storedSeq (
+    const uint8_t slot)
+{
+    return EEPROM_read(&journal[slot].seq);
+}
+
+static void locateNewest (void)
+{
+    nextSlot = 0;
+    nextSeq = 0;
+    for (uint8_t slot = 0; slot < SessionJournal_numEntries; ++slot) {
+        if (storedOutcome(slot) != sjo_empty) {
+            const uint8_t following = (slot + 1) % SessionJournal_numEntries;
+            const uint8_t seq = storedSeq(slot);
+            if ((storedOutcome(following) == sjo_empty) ||
+                (storedSeq(following) != (uint8_t)(seq + 1))) {
+                nextSlot = following;
+                nextSeq = seq + 1;
+                break;
+            }
+        }
+    }
+    haveLocatedNewest = true;
+}
+
+static void addSaturating (
+    const uint32_t value,
+    uint16_t *total)
+{
+    const uint32_t sum = *total + value;
+    *total = (sum > 65535) ? 65535 : (uint16_t)sum;
+}
+
+void SessionJournal_beginSession (void)
+{
+    uint8_t *bytes = (uint8_t*)&current;
+    for (uint8_t i = 0; i < sizeof(current); ++i) {
+        bytes[i] = 0;
+    }
+    uploaded = false;
+    phasesMarked = 0;
+    SystemTime_getCurrentTime(&phaseStartTime);
+    inSession = true;
+}
+
+void SessionJournal_markPhase (
+    const SessionJournal_Phase phase)
+{
+    if (inSession) {
+        SystemTime_t curTime;
+        SystemTime_getCurrentTime(&curTime);
+        const int32_t hundredths =
+            (SystemTime_diffSec(&curTime, &phaseStartTime) * 100) +
+            ((int16_t)curTime.hundredths - (int16_t)phaseStartTime.hundredths);
+        if (hundredths > 0) {
+            addSaturating(hundredths / 10, &current.phaseTime[phase]);
+        }
+        phaseStartTime = curTime;
+        phasesMarked |= (1 << phase);
+    }
+}
+
+void SessionJournal_noteSignalQuality (
+    const uint8_t csq)
+{
+    current.signalQuality = csq;
+}
+
+void SessionJournal_countSent (
+    const uint16_t bytes)
+{
+    addSaturating(bytes, &current.bytesSent);
+}
+
+void SessionJournal_countReceived (
+    const uint16_t bytes)
+{
+    addSaturating(bytes, &current.bytesReceived);
+}
+
+void SessionJournal_noteUploaded (void)
+{
+    uploaded = true;
+}
+
+void SessionJournal_endSession (void)
+{
+    if (!inSession) {
+        return;
+    }
+    inSession = false;
+
+    if (uploaded) {
+        current.outcome = sjo_uploaded;
+    } else if (phasesMarked & (1 << sjp_connect)) {
+        current.outcome = sjo_uploadFailed;
+    } else if (phasesMarked & (1 << sjp_registration)) {
+        current.outcome = sjo_noConnection;
+    } else if (phasesMarked & (1 << sjp_powerOn)) {
+        current.outcome = sjo_notRegistered;
+    } else {
+        current.outcome = sjo_noModule;
+    }
+
+    if (!haveLocatedNewest) {
+        locateNewest();
+    }
+    current.seq = nextSeq;
+    // the bytes are queued and written in order (this waits for the queue
+    // to make room when the entry doesn't fit in it)
+    uint8_t *eeBytes = (uint8_t*)&journal[nextSlot];
+    const uint8_t *bytes = (const uint8_t*)&current;
+    for (uint8_t i = 0; i < sizeof(current); ++i) {
+        EEPROM_write(eeBytes + i, bytes[i]);
+    }
+
+    nextSlot = (nextSlot + 1) % SessionJournal_numEntries;
+    ++nextSeq;
+}
+
+bool SessionJournal_getEntry (
+    const uint8_t age,
+    SessionJournal_Entry *entry)
+{
+    if (age >= SessionJournal_numEntries) {
+        return false;
+    }
+    if (!haveLocatedNewest) {
+        locateNewest();
+    }
+    const uint8_t slot =
+        (nextSlot + (SessionJournal_numEntries - 1) - age) %
+        SessionJournal_numEntries;
+    if (storedOutcome(slot) == sjo_empty) {
+        return false;
+    }
+    uint8_t *bytes = (uint8_t*)entry;
+    const uint8_t *eeBytes = (const uint8_t*)&journal[slot];
+    for (uint8_t i = 0; i < sizeof(SessionJournal_Entry); ++i) {
+        bytes[i] = EEPROM_read(eeBytes + i);
+    }
+    return true;
+}
+
+uint32_t SessionJournal_totalTime (
+    const SessionJournal_Entry *entry)
+{
+    uint32_t total = 0;
+    for (uint8_t phase = 0; phase < sjp_numPhases; ++phase) {
+        total += entry->phaseTime[phase];
+    }
+    return total;
+}
+
+#endif  // SESSIONJOURNAL_ENABLED
@@ -0,0 +1,110 @@
+//
+//  Session Journal
+//
+//  What it does:
+//     Records, for each cellular session, how long each phase of it took,
+//     the signal quality, the bytes sent and received and how the session
+//     turned out. The most recent sessions are kept in a ring in EEPROM so
+//     that they can be looked at after the fact to tune timeouts and to
+//     compare networks.
+//
+//  How to use it:
+//     Call SessionJournal_beginSession() when the cell module is powered
+//     up or woken, and SessionJournal_markPhase() as each phase ends. A
+//     phase's time runs from the previous mark, so a phase that is skipped
+//     is recorded as 0 and its time goes to the next phase that is marked.
+//     Call SessionJournal_endSession() once the module is powered down (or
+//     asleep) to write the entry. Calls outside a session are ignored.
+//
+
+#ifndef SESSIONJOURNAL_H
+#define SESSIONJOURNAL_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+// enable/disable the journal and the "journal" command. It doesn't fit in
+// flash along with everything else, so it's left out of normal builds
+#define SESSIONJOURNAL_ENABLED 0
+
+#define SessionJournal_numEntries 8
+
+typedef enum SessionJournal_Phase_enum {
+    sjp_powerOn,        // power up (or wake) until the module is ready
+    sjp_bringup,        // configuring the module and selecting a network
+    sjp_registration,   // waiting for the module to register
+    sjp_attach,         // GPRS attach and PDP context, up to CIPSTART
+    sjp_connect,        // CIPSTART until CONNECT OK
+    sjp_send,           // connected until teardown starts
+    sjp_teardown,       // teardown until peripheral power is cut
+    sjp_numPhases
+} SessionJournal_Phase;
+
+typedef enum SessionJournal_Outcome_enum {
+    sjo_uploaded,       // the samples were uploaded
+    sjo_uploadFailed,   // connected, but the upload didn't complete
+    sjo_noConnection,   // registered, but didn't connect to the host
+    sjo_notRegistered,  // the module was ready but didn't register
+    sjo_noModule,       // the module didn't become ready
+    sjo_empty = 0xFF    // (erased EEPROM) no session recorded
+} SessionJournal_Outcome;
+
+typedef struct SessionJournal_Entry_struct {
+    uint8_t seq;        // increments by one for each entry written
+    uint16_t phaseTime[sjp_numPhases];  // 1/10 second
+    uint8_t signalQuality;
+    uint16_t bytesSent;
+    uint16_t bytesReceived;
+    uint8_t outcome;
+} SessionJournal_Entry;
+
+#if SESSIONJOURNAL_ENABLED
+extern void SessionJournal_beginSession (void);
+extern void SessionJournal_markPhase (
+    const SessionJournal_Phase phase);
+extern void SessionJournal_noteSignalQuality (
+    const uint8_t csq);
+extern void SessionJournal_countSent (
+    const uint16_t bytes);
+extern void SessionJournal_countReceived (
+    const uint16_t bytes);
+extern void SessionJournal_noteUploaded (void);
+extern void SessionJournal_endSession (void);
+
+// gets the entry for the session that ended the given number of sessions
+// ago (0 is the most recent). returns false if there is no such entry
+extern bool SessionJournal_getEntry (
+    const uint8_t age,
+    SessionJournal_Entry *entry);
+
+// total of an entry's phase times, in 1/10 second
+extern uint32_t SessionJournal_totalTime (
+    const SessionJournal_Entry *entry);
+#else
+inline void SessionJournal_beginSession (void) {}
+inline void SessionJournal_markPhase (
+    const SessionJournal_Phase phase) {}
+inline void SessionJournal_noteSignalQuality (
+    const uint8_t csq) {}
+inline void SessionJournal_countSent (
+    const uint16_t bytes) {}
+inline void SessionJournal_countReceived (
+    const uint16_t bytes) {}
+inline void SessionJournal_noteUploaded (void) {}
+inline void SessionJournal_endSession (void) {}
+
+inline bool SessionJournal_getEntry (
+    const uint8_t age,
+    SessionJournal_Entry *entry)
+{
+    return false;
+}
+
+inline uint32_t SessionJournal_totalTime (
+    const SessionJournal_Entry *entry)
+{
+    return 0;
+}
+#endif
+
+#endif  // SESSIONJOURNAL_H
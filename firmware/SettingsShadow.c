@@ -0,0 +1,288 @@
+//
+//  Settings Shadow
+//
+//  How it works:
+//      The shadowed settings are read from EEPROMStorage into a struct in
+//      RAM, and a CRC of the struct is kept alongside it. Getters return
+//      the RAM copy. Setters write EEPROM through EEPROMStorage, then update
+//      the RAM copy and its CRC.
+//
+
+#include "SettingsShadow.h"
+
+#if SETTINGSSHADOW_ENABLED
+
+#include <util/crc16.h>
+#include "EEPROMStorage.h"
+#include "SystemTime.h"
+#include "Console.h"
+
+// units are 1/100 second
+#define VERIFY_INTERVAL 1000
+
+typedef struct Settings_struct {
+    uint16_t unitID;
+    uint16_t rebootInterval;
+    int16_t  tempCalOffset;
+    uint8_t  watchdogTimerCal;
+    uint8_t  batteryVoltageCal;
+    uint16_t monitorTaskTimeout;
+    uint16_t waterTankEmptyDistance;
+    uint16_t waterTankFullDistance;
+    uint8_t  waterLowNotificationLevel;
+    uint8_t  waterHighNotificationLevel;
+    uint8_t  levelIncreaseNotificationThreshold;
+    bool     notificationEnabled;
+    uint8_t  cipqsend;
+    uint16_t sampleInterval;
+    uint16_t loggingUpdateInterval;
+} Settings;
+
+// state variables
+static Settings settings;
+static uint16_t settingsCRC;
+static SystemTime_t nextVerifyTime;
+
+static uint16_t computeCRC (void)
+{
+    uint16_t crc = 0xFFFF;
+    const uint8_t *settingsBytes = (const uint8_t*)&settings;
+    for (uint8_t i = 0; i < sizeof(settings); ++i) {
+        crc = _crc_ccitt_update(crc, settingsBytes[i]);
+    }
+    return crc;
+}
+
+void SettingsShadow_Initialize (void)
+{
+    SettingsShadow_reload();
+    SystemTime_futureTime(VERIFY_INTERVAL, &nextVerifyTime);
+}
+
+void SettingsShadow_reload (void)
+{
+    settings.unitID = EEPROMStorage_unitID();
+    settings.rebootInterval = EEPROMStorage_rebootInterval();
+    settings.tempCalOffset = EEPROMStorage_tempCalOffset();
+    settings.watchdogTimerCal = EEPROMStorage_watchdogTimerCal();
+    settings.batteryVoltageCal = EEPROMStorage_batteryVoltageCal();
+    settings.monitorTaskTimeout = EEPROMStorage_monitorTaskTimeout();
+    settings.waterTankEmptyDistance = EEPROMStorage_waterTankEmptyDistance();
+    settings.waterTankFullDistance = EEPROMStorage_waterTankFullDistance();
+    settings.waterLowNotificationLevel = EEPROMStorage_waterLowNotificationLevel();
+    settings.waterHighNotificationLevel = EEPROMStorage_waterHighNotificationLevel();
+    settings.levelIncreaseNotificationThreshold = EEPROMStorage_levelIncreaseNotificationThreshold();
+    settings.notificationEnabled = EEPROMStorage_notificationEnabled();
+    settings.cipqsend = EEPROMStorage_cipqsend();
+    settings.sampleInterval = EEPROMStorage_sampleInterval();
+    settings.loggingUpdateInterval = EEPROMStorage_LoggingUpdateInterval();
+    settingsCRC = computeCRC();
+}
+
+void SettingsShadow_task (void)
+{
+    if (SystemTime_timeHasArrived(&nextVerifyTime)) {
+        if (computeCRC() != settingsCRC) {
+            Console_printP(PSTR("settings shadow corrupt"));
+            SettingsShadow_reload();
+        }
+        SystemTime_futureTime(VERIFY_INTERVAL, &nextVerifyTime);
+    }
+}
+
+void SettingsShadow_setUnitID (
+    const uint16_t value)
+{
+    EEPROMStorage_setUnitID(value);
+    settings.unitID = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_unitID (void)
+{
+    return settings.unitID;
+}
+
+void SettingsShadow_setRebootInterval (
+    const uint16_t value)
+{
+    EEPROMStorage_setRebootInterval(value);
+    settings.rebootInterval = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_rebootInterval (void)
+{
+    return settings.rebootInterval;
+}
+
+void SettingsShadow_setTempCalOffset (
+    const int16_t value)
+{
+    EEPROMStorage_setTempCalOffset(value);
+    settings.tempCalOffset = value;
+    settingsCRC = computeCRC();
+}
+
+int16_t SettingsShadow_tempCalOffset (void)
+{
+    return settings.tempCalOffset;
+}
+
+void SettingsShadow_setWatchdogTimerCal (
+    const uint8_t value)
+{
+    EEPROMStorage_setWatchdogTimerCal(value);
+    settings.watchdogTimerCal = value;
+    settingsCRC = computeCRC();
+}
+
+uint8_t SettingsShadow_watchdogTimerCal (void)
+{
+    return settings.watchdogTimerCal;
+}
+
+void SettingsShadow_setBatteryVoltageCal (
+    const uint8_t value)
+{
+    EEPROMStorage_setBatteryVoltageCal(value);
+    settings.batteryVoltageCal = value;
+    settingsCRC = computeCRC();
+}
+
+uint8_t SettingsShadow_batteryVoltageCal (void)
+{
+    return settings.batteryVoltageCal;
+}
+
+void SettingsShadow_setMonitorTaskTimeout (
+    const uint16_t value)
+{
+    EEPROMStorage_setMonitorTaskTimeout(value);
+    settings.monitorTaskTimeout = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_monitorTaskTimeout (void)
+{
+    return settings.monitorTaskTimeout;
+}
+
+void SettingsShadow_setWaterTankEmptyDistance (
+    const uint16_t value)
+{
+    EEPROMStorage_setWaterTankEmptyDistance(value);
+    settings.waterTankEmptyDistance = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_waterTankEmptyDistance (void)
+{
+    return settings.waterTankEmptyDistance;
+}
+
+void SettingsShadow_setWaterTankFullDistance (
+    const uint16_t value)
+{
+    EEPROMStorage_setWaterTankFullDistance(value);
+    settings.waterTankFullDistance = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_waterTankFullDistance (void)
+{
+    return settings.waterTankFullDistance;
+}
+
+void SettingsShadow_setWaterLowNotificationLevel (
+    const uint8_t value)
+{
+    EEPROMStorage_setWaterLowNotificationLevel(value);
+    settings.waterLowNotificationLevel = value;
+    settingsCRC = computeCRC();
+}
+
+uint8_t SettingsShadow_waterLowNotificationLevel (void)
+{
+    return settings.waterLowNotificationLevel;
+}
+
+void SettingsShadow_setWaterHighNotificationLevel (
+    const uint8_t value)
+{
+    EEPROMStorage_setWaterHighNotificationLevel(value);
+    settings.waterHighNotificationLevel = value;
+    settingsCRC = computeCRC();
+}
+
+uint8_t SettingsShadow_waterHighNotificationLevel (void)
+{
+    return settings.waterHighNotificationLevel;
+}
+
+void SettingsShadow_setLevelIncreaseNotificationThreshold (
+    const uint8_t value)
+{
+    EEPROMStorage_setLevelIncreaseNotificationThreshold(value);
+    settings.levelIncreaseNotificationThreshold = value;
+    settingsCRC = computeCRC();
+}
+
+uint8_t SettingsShadow_levelIncreaseNotificationThreshold (void)
+{
+    return settings.levelIncreaseNotificationThreshold;
+}
+
+void SettingsShadow_setNotification (
+    const bool value)
+{
+    EEPROMStorage_setNotification(value);
+    settings.notificationEnabled = value;
+    settingsCRC = computeCRC();
+}
+
+bool SettingsShadow_notificationEnabled (void)
+{
+    return settings.notificationEnabled;
+}
+
+void SettingsShadow_setCipqsend (
+    const uint8_t value)
+{
+    EEPROMStorage_setCipqsend(value);
+    settings.cipqsend = value;
+    settingsCRC = computeCRC();
+}
+
+uint8_t SettingsShadow_cipqsend (void)
+{
+    return settings.cipqsend;
+}
+
+void SettingsShadow_setSampleInterval (
+    const uint16_t value)
+{
+    EEPROMStorage_setSampleInterval(value);
+    settings.sampleInterval = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_sampleInterval (void)
+{
+    return settings.sampleInterval;
+}
+
+void SettingsShadow_setLoggingUpdateInterval (
+    const uint16_t value)
+{
+    EEPROMStorage_setLoggingUpdateInterval(value);
+    settings.loggingUpdateInterval = value;
+    settingsCRC = computeCRC();
+}
+
+uint16_t SettingsShadow_loggingUpdateInterval (void)
+{
+    return settings.loggingUpdateInterval;
+}
+
+#endif  // SETTINGSSHADOW_ENABLED
@@ -0,0 +1,143 @@
+//
+//  Settings Shadow
+//
+//  What it does:
+//     Keeps a RAM copy of the scalar settings in EEPROMStorage so that
+//     tasks that consult them on every pass of the main loop or on every
+//     sample don't read EEPROM each time.
+//
+//  How to use it:
+//     Call SettingsShadow_Initialize() after EEPROMStorage_Initialize().
+//     Read these settings through the getters here rather than through
+//     EEPROMStorage, and change them through the setters here, which
+//     write through to EEPROM. If EEPROM is changed behind the shadow's
+//     back (e.g. by eewrite) call SettingsShadow_reload().
+//     The shadow is protected by a CRC that SettingsShadow_task()
+//     checks periodically, reloading it from EEPROM if it is corrupt.
+//
+
+#ifndef SETTINGSSHADOW_H
+#define SETTINGSSHADOW_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stddef.h>
+
+// enable/disable the shadow. Without it the getters and setters here are
+// EEPROMStorage's own, which costs a few cycles per read but saves flash
+// and RAM for everything else
+#define SETTINGSSHADOW_ENABLED 0
+
+#if SETTINGSSHADOW_ENABLED
+extern void SettingsShadow_Initialize (void);
+
+// reloads all shadowed settings from EEPROM
+extern void SettingsShadow_reload (void);
+
+// checks the shadow's integrity from time to time.
+// called in each iteration of the mainloop
+extern void SettingsShadow_task (void);
+
+extern void SettingsShadow_setUnitID (
+    const uint16_t id);
+extern uint16_t SettingsShadow_unitID (void);
+
+// units are minutes
+extern void SettingsShadow_setRebootInterval (
+    const uint16_t rebootMinutes);
+extern uint16_t SettingsShadow_rebootInterval (void);
+
+extern void SettingsShadow_setTempCalOffset (
+    const int16_t offset);
+extern int16_t SettingsShadow_tempCalOffset (void);
+
+// units are 1%
+extern void SettingsShadow_setWatchdogTimerCal (
+    const uint8_t wdtCal);
+extern uint8_t SettingsShadow_watchdogTimerCal (void);
+
+// units are 1%
+extern void SettingsShadow_setBatteryVoltageCal (
+    const uint8_t batCal);
+extern uint8_t SettingsShadow_batteryVoltageCal (void);
+
+// units are seconds
+extern void SettingsShadow_setMonitorTaskTimeout (
+    const uint16_t wlmTimeout);
+extern uint16_t SettingsShadow_monitorTaskTimeout (void);
+
+// units are cm
+extern void SettingsShadow_setWaterTankEmptyDistance (
+    const uint16_t value);
+extern uint16_t SettingsShadow_waterTankEmptyDistance (void);
+extern void SettingsShadow_setWaterTankFullDistance (
+    const uint16_t value);
+extern uint16_t SettingsShadow_waterTankFullDistance (void);
+
+// units are percent (tank percent full)
+extern void SettingsShadow_setWaterLowNotificationLevel (
+    const uint8_t level);
+extern uint8_t SettingsShadow_waterLowNotificationLevel (void);
+extern void SettingsShadow_setWaterHighNotificationLevel (
+    const uint8_t level);
+extern uint8_t SettingsShadow_waterHighNotificationLevel (void);
+extern void SettingsShadow_setLevelIncreaseNotificationThreshold (
+    const uint8_t percentIncrease);
+extern uint8_t SettingsShadow_levelIncreaseNotificationThreshold (void);
+
+extern void SettingsShadow_setNotification (
+    const bool onOff);
+extern bool SettingsShadow_notificationEnabled (void);
+
+extern void SettingsShadow_setCipqsend (
+    const uint8_t qsend);
+extern uint8_t SettingsShadow_cipqsend (void);
+
+// units are seconds
+extern void SettingsShadow_setSampleInterval (
+    const uint16_t updateInterval);
+extern uint16_t SettingsShadow_sampleInterval (void);
+extern void SettingsShadow_setLoggingUpdateInterval (
+    const uint16_t updateInterval);
+extern uint16_t SettingsShadow_loggingUpdateInterval (void);
+#else
+#include "EEPROMStorage.h"
+
+inline void SettingsShadow_Initialize (void) {}
+inline void SettingsShadow_reload (void) {}
+inline void SettingsShadow_task (void) {}
+
+#define SettingsShadow_setUnitID EEPROMStorage_setUnitID
+#define SettingsShadow_unitID EEPROMStorage_unitID
+#define SettingsShadow_setRebootInterval EEPROMStorage_setRebootInterval
+#define SettingsShadow_rebootInterval EEPROMStorage_rebootInterval
+#define SettingsShadow_setTempCalOffset EEPROMStorage_setTempCalOffset
+#define SettingsShadow_tempCalOffset EEPROMStorage_tempCalOffset
+#define SettingsShadow_setWatchdogTimerCal EEPROMStorage_setWatchdogTimerCal
+#define SettingsShadow_watchdogTimerCal EEPROMStorage_watchdogTimerCal
+#define SettingsShadow_setBatteryVoltageCal EEPROMStorage_setBatteryVoltageCal
+#define SettingsShadow_batteryVoltageCal EEPROMStorage_batteryVoltageCal
+#define SettingsShadow_setMonitorTaskTimeout EEPROMStorage_setMonitorTaskTimeout
+#define SettingsShadow_monitorTaskTimeout EEPROMStorage_monitorTaskTimeout
+#define SettingsShadow_setWaterTankEmptyDistance EEPROMStorage_setWaterTankEmptyDistance
+#define SettingsShadow_waterTankEmptyDistance EEPROMStorage_waterTankEmptyDistance
+#define SettingsShadow_setWaterTankFullDistance EEPROMStorage_setWaterTankFullDistance
+#define SettingsShadow_waterTankFullDistance EEPROMStorage_waterTankFullDistance
+#define SettingsShadow_setWaterLowNotificationLevel EEPROMStorage_setWaterLowNotificationLevel
+#define SettingsShadow_waterLowNotificationLevel EEPROMStorage_waterLowNotificationLevel
+#define SettingsShadow_setWaterHighNotificationLevel EEPROMStorage_setWaterHighNotificationLevel
+#define SettingsShadow_waterHighNotificationLevel EEPROMStorage_waterHighNotificationLevel
+#define SettingsShadow_setLevelIncreaseNotificationThreshold EEPROMStorage_setLevelIncreaseNotificationThreshold
+#define SettingsShadow_levelIncreaseNotificationThreshold EEPROMStorage_levelIncreaseNotificationThreshold
+#define SettingsShadow_setNotification EEPROMStorage_setNotification
+#define SettingsShadow_notificationEnabled EEPROMStorage_notificationEnabled
+#define SettingsShadow_setCipqsend EEPROMStorage_setCipqsend
+#define SettingsShadow_cipqsend EEPROMStorage_cipqsend
+#define SettingsShadow_setSampleInterval EEPROMStorage_setSampleInterval
+#define SettingsShadow_sampleInterval EEPROMStorage_sampleInterval
+#define SettingsShadow_setLoggingUpdateInterval EEPROMStorage_setLoggingUpdateInterval
+#define SettingsShadow_loggingUpdateInterval EEPROMStorage_LoggingUpdateInterval
+#endif
+
+#endif      /* SETTINGSSHADOW_H */
@@ -7,6 +7,97 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+// The ATmega has no divide instruction, and / and % on 16 and 32 bit
+// values are library calls (__udivmodhi4, __udivmodsi4). Decimal
+// conversion therefore divides by 10 with shifts and adds (Hacker's
+// Delight divu10), and multiplies a 32 bit value by 10 with shifts and
+// adds instead of calling __mulsi3. Neither depends on the compiler
+// narrowing a multiply, so the code is the same on old and new avr-gcc.
+// firmware/bench compares these against the library division
+// (StringUtils_appendDecimal* vs *_libdiv).
+
+// returns n / 10 and sets *remainder to n % 10
+static inline uint16_t divu10_16 (
+    const uint16_t n,
+    uint8_t *remainder)
+{
+    uint16_t q = (n >> 1) + (n >> 2);
+    q += (q >> 4);
+    q += (q >> 8);
+    q >>= 3;
+    uint8_t r = (uint8_t)(n - ((q << 3) + (q << 1)));
+    if (r > 9) {
+        // the estimate is at most one too small
+        ++q;
+        r -= 10;
+    }
+    *remainder = r;
+    return q;
+}
+
+// returns n / 10 and sets *remainder to n % 10
+static inline uint32_t divu10_32 (
+    const uint32_t n,
+    uint8_t *remainder)
+{
+    uint32_t q = (n >> 1) + (n >> 2);
+    q += (q >> 4);
+    q += (q >> 8);
+    q += (q >> 16);
+    q >>= 3;
+    uint8_t r = (uint8_t)(n - ((q << 3) + (q << 1)));
+    if (r > 9) {
+        // the estimate is at most one too small
+        ++q;
+        r -= 10;
+    }
+    *remainder = r;
+    return q;
+}
+
+static inline uint32_t times10_32 (
+    const uint32_t n)
+{
+    return (n << 3) + (n << 1);
+}
+
+// writes the decimal digits of value backwards from cp, and returns
+// a pointer to the first character written
+static char* formatDecimal (
+    uint32_t workingValue,
+    const bool isNegative,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    char* cp)
+{
+    uint8_t digit;
+
+    // working backwards, start with fractional digits
+    if (numFractionalDigits > 0) {
+        for (uint8_t f = 0; f < numFractionalDigits; ++f) {
+            workingValue = (workingValue > 0xFFFF)
+                ? divu10_32(workingValue, &digit)
+                : divu10_16(workingValue, &digit);
+            *cp-- = digit + '0';
+        }
+        *cp-- = '.';
+    }
+
+    // continue with integer digits
+    for (uint8_t i = 0; (i < minIntegerDigits) || (workingValue != 0); ++i) {
+        workingValue = (workingValue > 0xFFFF)
+            ? divu10_32(workingValue, &digit)
+            : divu10_16(workingValue, &digit);
+        *cp-- = digit + '0';
+    }
+
+    // insert sign for negative value
+    if (isNegative) {
+        *cp-- = '-';
+    }
+    return cp + 1;
+}
+
 inline bool isWhitespace (
     const char ch)
 {
@@ -137,7 +228,7 @@ void StringUtils_scanIntegerU32 (
     char ch;
     bool gotDigit = false;
     while ((iter != end) && (ch = *iter) && (ch >= '0') && (ch <= '9')) {
-        workingValue = (workingValue * 10) + (ch - '0');
+        workingValue = times10_32(workingValue) + (ch - '0');
         ++iter;
         gotDigit = true;
     }
@@ -215,31 +306,12 @@ void StringUtils_appendDecimal (
     CharString_t* destStr)
 {
     char strBuffer[16];
-    char* cp = &strBuffer[15];
-    *cp-- = 0;  // null terminate
-
-    uint16_t workingValue = (value < 0) ? -value : value;
-
-    // working backwards, start with fractional digits
-    if (numFractionalDigits > 0) {
-        for (int f = 0; f < numFractionalDigits; ++f) {
-            *cp-- = (workingValue % 10) + '0';
-            workingValue /= 10;
-        }
-        *cp-- = '.';
-    }
-
-    // continue with integer digits
-    for (int i = 0; (i < minIntegerDigits) || (workingValue != 0); ++i) {
-        *cp-- = (workingValue % 10) + '0';
-        workingValue /= 10;
-    }
-
-    // insert sign for negative value
-    if (value < 0) {
-        *cp-- = '-';
-    }
-    CharString_append(cp+1, destStr);
+    strBuffer[15] = 0;  // null terminate
+    const uint16_t magnitude = (value < 0) ? -value : value;
+    CharString_append(
+        formatDecimal(magnitude, value < 0,
+            minIntegerDigits, numFractionalDigits, &strBuffer[14]),
+        destStr);
 }
 
 void StringUtils_appendDecimal32 (
@@ -249,36 +321,48 @@ void StringUtils_appendDecimal32 (
     CharString_t* destStr)
 {
     char strBuffer[16];
-    char* cp = &strBuffer[15];
-    *cp-- = 0;  // null terminate
+    strBuffer[15] = 0;  // null terminate
+    const uint32_t magnitude = (value < 0) ? -value : value;
+    CharString_append(
+        formatDecimal(magnitude, value < 0,
+            minIntegerDigits, numFractionalDigits, &strBuffer[14]),
+        destStr);
+}
 
-    uint32_t workingValue = (value < 0) ? -value : value;
+int StringUtils_lookupString (
+    const CharStringSpan_t *str,
+    PGM_P table[],
+    const int tableSize)
+{
+    int first = 0;
+    int last = tableSize - 1;
+    int middle;
 
-    // working backwards, start with fractional digits
-    if (numFractionalDigits > 0) {
-        for (int f = 0; f < numFractionalDigits; ++f) {
-            *cp-- = (workingValue % 10) + '0';
-            workingValue /= 10;
+    while (first <= last) {
+        middle = (first + last) / 2;
+        PGM_P tableEntry = (PGM_P)pgm_read_word(&(table[middle]));
+        const int comparison = CharStringSpan_compareP(str, tableEntry);
+        if (comparison == 0) {
+            // found at index middle;
+            break;
+        } else if (comparison > 0) {
+            first = middle + 1;    
+        } else {
+            last = middle - 1;
         }
-        *cp-- = '.';
     }
-
-    // continue with integer digits
-    for (int i = 0; (i < minIntegerDigits) || (workingValue != 0); ++i) {
-        *cp-- = (workingValue % 10) + '0';
-        workingValue /= 10;
+    if (first > last) {
+        // Not found!
+        middle = tableSize;
     }
 
-    // insert sign for negative value
-    if (value < 0) {
-        *cp-- = '-';
-    }
-    CharString_append(cp+1, destStr);
+    return middle;
 }
 
-int StringUtils_lookupString (
+int StringUtils_lookupNameNocase (
     const CharStringSpan_t *str,
-    PGM_P table[],
+    const void *table,
+    const size_t entrySize,
     const int tableSize)
 {
     int first = 0;
@@ -287,13 +371,15 @@ int StringUtils_lookupString (
 
     while (first <= last) {
         middle = (first + last) / 2;
-        PGM_P tableEntry = (PGM_P)pgm_read_word(&(table[middle]));
-        const int comparison = CharStringSpan_compareP(str, tableEntry);
+        const PGM_P *entryName =
+            (const PGM_P*)(((const char*)table) + (middle * entrySize));
+        const int comparison =
+            CharStringSpan_compareNocaseP(str, (PGM_P)pgm_read_word(entryName));
         if (comparison == 0) {
             // found at index middle;
             break;
         } else if (comparison > 0) {
-            first = middle + 1;    
+            first = middle + 1;
         } else {
             last = middle - 1;
         }
@@ -78,4 +78,14 @@ extern int StringUtils_lookupString (
     PGM_P table[],
     const int tableSize);
 
+// looks up str in a table of structs in program memory, each of which
+// begins with a PGM_P name. table must be in case-insensitive ASCII
+// collation order. comparison ignores case.
+// returns index of match (0..tableSize-1), or tableSize if not found
+extern int StringUtils_lookupNameNocase (
+    const CharStringSpan_t *str,
+    const void *table,
+    const size_t entrySize,
+    const int tableSize);
+
 #endif  // StringUtils_H
\ No newline at end of file
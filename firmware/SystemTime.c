@@ -13,6 +13,8 @@
 #include "StringUtils.h"
 #include "Console.h"
 #include "EEPROMStorage.h"
+#include "EEPROM_Util.h"
+#include "SettingsShadow.h"
 
 #define DEBUG_TRACE 1
 
@@ -23,6 +25,9 @@ static int32_t timeAdjustment;
 static bool shuttingDown = false;
 static SystemTime_LastRebootBy lastRebootBy;
 static SystemTime_TickNotification notificationFunction;
+// (this object links after EEPROMStorage.o, so the count goes after the
+// settings block in EEPROM)
+static uint16_t coldBootCount EEMEM;
 
 void SystemTime_Initialize (void)
 {
@@ -84,6 +89,13 @@ SystemTime_LastRebootBy SystemTime_LastReboot (void)
     return lastRebootBy;
 }
 
+uint16_t SystemTime_countColdBoot (void)
+{
+    const uint16_t bootCount = EEPROM_readWord(&coldBootCount) + 1;
+    EEPROM_writeWord(&coldBootCount, bootCount);
+    return bootCount;
+}
+
 void SystemTime_futureTime (
     const int hundredthsFromNow,
     SystemTime_t* futureTime)
@@ -145,8 +157,12 @@ void SystemTime_sleepFor (
     const uint16_t seconds)
 {
     uint32_t calibratedSeconds = 
-        (((uint32_t)seconds) * EEPROMStorage_watchdogTimerCal()) / 100;
+        (((uint32_t)seconds) * SettingsShadow_watchdogTimerCal()) / 100;
     uint16_t secondsRemaining = calibratedSeconds;
+
+    // queued EEPROM writes don't progress in power-down
+    EEPROM_flush();
+
     while (secondsRemaining > 0) {
         uint8_t wdtTimeout;
         uint8_t secondsThisLoop;
@@ -216,8 +232,8 @@ void SystemTime_task (void)
         // since startup
         const uint32_t uptime = SystemTime_uptime();
         const uint32_t rebootIntervalSeconds =
-            (((uint32_t)EEPROMStorage_rebootInterval()) * 60) +
-            (((uint32_t)EEPROMStorage_LoggingUpdateInterval()) * 3);
+            (((uint32_t)SettingsShadow_rebootInterval()) * 60) +
+            (((uint32_t)SettingsShadow_loggingUpdateInterval()) * 3);
         if (uptime > rebootIntervalSeconds) {
             SystemTime_commenceShutdown();
         }
@@ -44,6 +44,9 @@ extern void SystemTime_getCurrentTime (
 
 extern uint32_t SystemTime_uptime (void);
 extern SystemTime_LastRebootBy SystemTime_LastReboot (void);
+// counts a boot that started without any state carried over from before
+// it, and returns the new count. the count is kept in EEPROM
+extern uint16_t SystemTime_countColdBoot (void);
 
 // initializes futureTime to the current time plus
 // the given number of 1/100 seconds
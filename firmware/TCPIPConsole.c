@@ -9,6 +9,7 @@
 #include "CommandProcessor.h"
 #include "SystemTime.h"
 #include "EEPROMStorage.h"
+#include "ScratchArena.h"
 
 #define DEBUG_TRACE 0
 
@@ -80,14 +81,16 @@ void TCPIPConsole_task (void)
                         sState = ss_waitingForDisconnect;
                     }
                     break;
-                case cs_disconnected :
-                    if (isEnabled && SystemTime_timeHasArrived(&nextConnectAttemptTime)) {
-                        CharString_define(60, server);
+                case cs_disconnected : {
+                    CharString_t server;
+                    if (isEnabled && SystemTime_timeHasArrived(&nextConnectAttemptTime) &&
+                        ScratchArena_allocString(60, &server)) {
                         EEPROMStorage_getIPConsoleServerAddress(&server);
                         const uint16_t port = EEPROMStorage_ipConsoleServerPort();
                         CellularTCPIP_connect(&server, port, dataReceiver, statusCallback);
                         sState = ss_waitingForTCPIPConnecting;
                     }
+                    }
                     break;
                 default:
                     break;
@@ -10,7 +10,7 @@
 #include "WaterLevelMonitor.h"
 
 #include "SystemTime.h"
-#include "EEPROMStorage.h"
+#include "SettingsShadow.h"
 //#include "Thingspeak.h"
 #include "BatteryMonitor.h"
 #include "InternalTemperatureMonitor.h"
@@ -23,8 +23,12 @@
 #include "CommandProcessor.h"
 #include "SampleHistory.h"
 #include "RAMSentinel.h"
+#include "ByteQueue.h"
+#include "SessionJournal.h"
+#include "PostScheduler.h"
+#include <util/crc16.h>
 
-#define SW_VERSION 10
+#define SW_VERSION 12
 
 // water level has to change by this percentage or more
 // to get back to inRange after going out of range
@@ -44,6 +48,31 @@ typedef enum SendDataStatus_enum {
     sds_completedFailed
 } SendDataStatus;
 
+// Samples are numbered so that the host can tell us how much of a failed
+// upload it got, and so that it can discard samples it already has when
+// they are sent again. The count of cold boots goes in the upper bits so
+// that numbering carries on upward after the retained state is lost.
+#define SEQ_BOOT_COUNT_SHIFT 20
+#define SEQ_BOOT_COUNT_MASK 0x7FF
+
+// attempts to upload samples in one session
+#define MAX_UPLOAD_ATTEMPTS 2
+
+// how long to wait, after a failed upload, for the host to acknowledge
+// the samples it did get. units are 1/100 second
+#define ACK_TIMEOUT 500
+
+// upper bounds on the steps of ending a session, in 1/100 second. each
+// step moves on as soon as what it is waiting for has happened:
+// the connection going idle,
+#define TEARDOWN_CLOSE_TIMEOUT 200
+// the cell module closing the connection and powering down (or going
+// to sleep),
+#define TEARDOWN_DISABLE_TIMEOUT 200
+// and, if the cell module didn't report that it powered down, a last
+// delay before peripheral power is cut
+#define TEARDOWN_POWER_CUT_DELAY 50
+
 typedef enum CommandProcessingMode_enum {
     cpm_singleCommand,
     cpm_commandBlock
@@ -57,16 +86,171 @@ static CommandProcessingMode commandMode = cpm_singleCommand;
 static SendDataStatus sendDataStatus;
 static SystemTime_t time;   // used to measure how long it took to get a connection,
                             // and for the powerdown delay future time
-static bool gotCommandFromHost;
-static SystemTime_t lastSampleTime;
-static SampleHistory_define(30, sampleHistory);
 static int16_t dataSenderSampleIndex;
-static CharStringSpan_t remainingReplyDataToSend;
-static WaterLevelState currentWaterLevelState;
-static int8_t currentWaterLevelPercent;
-static int8_t lastReportedWaterLevelPercent;
+static uint8_t uploadAttempts;
+static bool awaitingAck;
+static bool resendSamples;
+static bool sessionUploaded;
+// whether the level alert has been tried in this session, and the time
+// from the threshold crossing until it was sent (1/10 second, 0 if no
+// alert was sent), which is reported in this session's upload
+static bool alertTried;
+static uint16_t alertLatency;
+static SystemTime_t ackDeadline;
+// when the current session started to end, and how long ending the
+// previous one took (1/100 second), which is reported in the next upload
+static SystemTime_t teardownStartTime;
+static bool measuringTeardown;
+static uint16_t lastTeardownTime;
+
+// State that survives a software reboot. It lives in .noinit so the C
+// runtime leaves it alone at startup, and is guarded by a CRC (see
+// sealRetainedState()) so that it is only trusted if it was completely
+// written by the software that is running now.
+#define SAMPLE_HISTORY_LEN 30
+typedef struct RetainedState_struct {
+    uint16_t version;
+    uint32_t firstSampleSeq;    // sequence number of oldest sample
+    SystemTime_t lastSampleTime;
+    SampleHistory_Sample sampleBuffer[SAMPLE_HISTORY_LEN];
+    SampleHistory_t sampleHistory;
+    WaterLevelState currentWaterLevelState;
+    int8_t currentWaterLevelPercent;
+    int8_t lastReportedWaterLevelPercent;
+    bool alertPending;          // level went out of range, host not told yet
+    SystemTime_t alertTime;     // time of the sample that went out of range
+    uint16_t crc;
+} RetainedState;
+static RetainedState retained __attribute__ ((section (".noinit")));
+
+// commands received from the host that are waiting to be executed.
+// each command in the queue is terminated by '\n'. when the queue
+// overflows, the command that didn't fit is ended with
+// HOST_COMMAND_OVERFLOW and gets an error reply instead of being
+// executed, and the commands after it are dropped until that command has
+// been taken off the queue. room for the marker and terminator is always
+// kept spare
+#define HOST_COMMAND_QUEUE_LEN 128
+#define HOST_COMMAND_QUEUE_SPARE 2
+#define HOST_COMMAND_OVERFLOW '\x18'
+ByteQueue_define(HOST_COMMAND_QUEUE_LEN, hostCommandQueue, static);
+static uint8_t numQueuedHostCommands;
+static bool atStartOfHostCommand;
+static bool hostCommandOverflow;
+static bool discardingHostCommand;
+// the command popped from the queue is one that didn't fit
+static bool hostCommandRejected;
 
 #define DATA_SENDER_BUFFER_LEN 30
+// the per-post header is written straight into the output queue
+#define DATA_SENDER_HEADER_LEN 112
+// the level alert is sent on its own, ahead of the per-post header
+#define ALERT_FRAME_LEN 32
+
+// returns the time of the oldest sample
+static uint32_t firstSampleTime (void)
+{
+    uint32_t sampleTime = retained.lastSampleTime.seconds;
+    for (uint8_t i = 1; i < SampleHistory_length(&retained.sampleHistory); ++i) {
+        sampleTime -= SampleHistory_getAt(i, &retained.sampleHistory)->relSampleTime;
+    }
+    return sampleTime;
+}
+
+static void writeSampleDataHeader (void)
+{
+    ReplyWriter_t header;
+    ReplyWriter_initForStream(
+        CellularTCPIP_availableSpaceForWriteData,
+        CellularTCPIP_writeDataCSS,
+        &header);
+    ReplyWriter_writeC('I', &header);
+    ReplyWriter_writeDecimal(SettingsShadow_unitID(), 1, 0, &header);
+    ReplyWriter_writeC('V', &header);
+    ReplyWriter_writeDecimal(SW_VERSION, 1, 0, &header);
+    ReplyWriter_writeC('B', &header);
+    ReplyWriter_writeDecimal(BatteryMonitor_currentVoltage(), 1, 0, &header);
+    ReplyWriter_writeC('R', &header);
+    ReplyWriter_writeDecimal((int)CellularComm_registrationStatus(), 1, 0, &header);
+    ReplyWriter_writeC('Q', &header);
+    ReplyWriter_writeDecimal(CellularComm_SignalQuality(), 1, 0, &header);
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    const int32_t secondsSinceLastSample = SystemTime_diffSec(&curTime, &retained.lastSampleTime);
+    ReplyWriter_writeC('C', &header);
+    ReplyWriter_writeDecimal32(secondsSinceLastSample, 1, 0, &header);
+    // sequence number and time of the first sample in this post
+    ReplyWriter_writeC('S', &header);
+    ReplyWriter_writeDecimal32(retained.firstSampleSeq, 1, 0, &header);
+    ReplyWriter_writeC('A', &header);
+    ReplyWriter_writeDecimal32(firstSampleTime(), 1, 0, &header);
+    // stack high-water mark, RAM never used, and the task that went deepest
+    ReplyWriter_writeC('K', &header);
+    ReplyWriter_writeDecimal(RAMSentinel_stackHighWater(), 1, 0, &header);
+    ReplyWriter_writeC('F', &header);
+    ReplyWriter_writeDecimal(RAMSentinel_freeMargin(), 1, 0, &header);
+    ReplyWriter_writeC('J', &header);
+    ReplyWriter_writeDecimal(RAMSentinel_highWaterTaskID(), 1, 0, &header);
+    // how long the cell module took to register, and whether it was
+    // asked for the cached network
+    ReplyWriter_writeC('G', &header);
+    ReplyWriter_writeDecimal32(CellularComm_registrationTime(), 1, 0, &header);
+    ReplyWriter_writeC('H', &header);
+    ReplyWriter_writeDecimal((int)CellularComm_networkSelection(), 1, 0, &header);
+    // how long it took to end the previous session
+    ReplyWriter_writeC('E', &header);
+    ReplyWriter_writeDecimal32(lastTeardownTime, 1, 0, &header);
+    // outcome and length of the last session in the journal
+    SessionJournal_Entry lastSession;
+    if (SessionJournal_getEntry(0, &lastSession)) {
+        ReplyWriter_writeC('O', &header);
+        ReplyWriter_writeDecimal(lastSession.outcome, 1, 0, &header);
+        ReplyWriter_writeC('L', &header);
+        ReplyWriter_writeDecimal32(
+            SessionJournal_totalTime(&lastSession), 1, 0, &header);
+    }
+#if POSTSCHEDULER_ENABLED
+    // scheduled posts put off since the last successful upload
+    ReplyWriter_writeC('P', &header);
+    ReplyWriter_writeDecimal(PostScheduler_postsDeferred(), 1, 0, &header);
+#endif
+    // how long the level alert took to get out
+    if (alertLatency != 0) {
+        ReplyWriter_writeC('N', &header);
+        ReplyWriter_writeDecimal32(alertLatency, 1, 0, &header);
+    }
+    ReplyWriter_writeC(';', &header);
+}
+
+// sends the level alert: '!', the level state, then the unit ID, level
+// percent, water distance and seconds since the level went out of range
+static bool alertDataSender (void)
+{
+    if (CellularTCPIP_availableSpaceForWriteData() < ALERT_FRAME_LEN) {
+        // check again next time we're called
+        return false;
+    }
+    ReplyWriter_t alert;
+    ReplyWriter_initForStream(
+        CellularTCPIP_availableSpaceForWriteData,
+        CellularTCPIP_writeDataCSS,
+        &alert);
+    ReplyWriter_writeC('!', &alert);
+    ReplyWriter_writeC((char)retained.currentWaterLevelState, &alert);
+    ReplyWriter_writeC('I', &alert);
+    ReplyWriter_writeDecimal(SettingsShadow_unitID(), 1, 0, &alert);
+    ReplyWriter_writeC('P', &alert);
+    ReplyWriter_writeDecimal(retained.currentWaterLevelPercent, 1, 0, &alert);
+    ReplyWriter_writeC('W', &alert);
+    ReplyWriter_writeDecimal(UltrasonicSensorMonitor_currentDistance(), 1, 0, &alert);
+    SystemTime_t curTime;
+    SystemTime_getCurrentTime(&curTime);
+    ReplyWriter_writeC('C', &alert);
+    ReplyWriter_writeDecimal32(
+        SystemTime_diffSec(&curTime, &retained.alertTime), 1, 0, &alert);
+    ReplyWriter_writeC(';', &alert);
+    return true;
+}
 
 static bool sampleDataSender (void)
 {
@@ -74,32 +258,20 @@ static bool sampleDataSender (void)
 
     // check to see if there is enough room in the output queue for our data. If
     // not, we check again next time we're called.
-    if (CellularTCPIP_availableSpaceForWriteData() >= DATA_SENDER_BUFFER_LEN) {
+    const uint16_t spaceNeeded = (dataSenderSampleIndex == -1)
+        ? DATA_SENDER_HEADER_LEN
+        : DATA_SENDER_BUFFER_LEN;
+    if (CellularTCPIP_availableSpaceForWriteData() >= spaceNeeded) {
         // there is room in the output queue for our data
         CharString_define(DATA_SENDER_BUFFER_LEN, dataToSend);
         // RAMSentinel_printStackPtr();
         if (dataSenderSampleIndex == -1) {
             // send per-post data
-            CharString_copyP(PSTR("I"), &dataToSend);
-            StringUtils_appendDecimal(EEPROMStorage_unitID(), 1, 0, &dataToSend);
-            CharString_appendC('V', &dataToSend);
-            StringUtils_appendDecimal(SW_VERSION, 1, 0, &dataToSend);
-            CharString_appendC('B', &dataToSend);
-            StringUtils_appendDecimal(BatteryMonitor_currentVoltage(), 1, 0, &dataToSend);
-            CharString_appendC('R', &dataToSend);
-            StringUtils_appendDecimal((int)CellularComm_registrationStatus(), 1, 0, &dataToSend);
-            CharString_appendC('Q', &dataToSend);
-            StringUtils_appendDecimal(CellularComm_SignalQuality(), 1, 0, &dataToSend);
-            SystemTime_t curTime;
-            SystemTime_getCurrentTime(&curTime);
-            const int32_t secondsSinceLastSample = SystemTime_diffSec(&curTime, &lastSampleTime);
-            CharString_appendP(PSTR("C"), &dataToSend);
-            StringUtils_appendDecimal(secondsSinceLastSample, 1, 0, &dataToSend);
-            CharString_appendC(';', &dataToSend);
+            writeSampleDataHeader();
         } else {
             // send next sample
             const SampleHistory_Sample* sample =
-                SampleHistory_getAt(dataSenderSampleIndex, &sampleHistory);
+                SampleHistory_getAt(dataSenderSampleIndex, &retained.sampleHistory);
             if (sample->relSampleTime != 0) {
                 CharString_appendC('D', &dataToSend);
                 StringUtils_appendDecimal(sample->relSampleTime, 1, 0, &dataToSend);
@@ -112,9 +284,8 @@ static bool sampleDataSender (void)
         }
 
         ++dataSenderSampleIndex;
-        // if this is the last sample append the delta time between the last sample and
-        // now, and append the terminator (Z)
-        if (dataSenderSampleIndex >= ((int16_t)SampleHistory_length(&sampleHistory))) {
+        // if this is the last sample append the terminator (Z)
+        if (dataSenderSampleIndex >= ((int16_t)SampleHistory_length(&retained.sampleHistory))) {
             CharString_appendP(PSTR("Z\n"), &dataToSend);
             sendComplete = true;
         }
@@ -124,21 +295,121 @@ static bool sampleDataSender (void)
     return sendComplete;
 }
 
+// pops the next command from the host command queue into
+// CommandProcessor_incomingCommand. mode command characters
+// are processed here, leaving CommandProcessor_incomingCommand empty
+static void popNextHostCommand (void)
+{
+    CharString_clear(&CommandProcessor_incomingCommand);
+    for (;;) {
+        const char c = ByteQueue_pop(&hostCommandQueue);
+        if (c == '\n') {
+            break;
+        }
+        CharString_appendC(c, &CommandProcessor_incomingCommand);
+    }
+    --numQueuedHostCommands;
+
+    const uint8_t cmdLen = CharString_length(&CommandProcessor_incomingCommand);
+    hostCommandRejected =
+        (cmdLen > 0) &&
+        (CharString_at(&CommandProcessor_incomingCommand, cmdLen - 1) == HOST_COMMAND_OVERFLOW);
+    if (hostCommandRejected) {
+        CharString_clear(&CommandProcessor_incomingCommand);
+        // take commands again, starting at the next whole one
+        hostCommandOverflow = false;
+        discardingHostCommand = !atStartOfHostCommand;
+    } else if (CharString_length(&CommandProcessor_incomingCommand) == 1) {
+        // check for mode command characters
+        switch (CharString_at(&CommandProcessor_incomingCommand, 0)) {
+            case '[' :
+                commandMode = cpm_commandBlock;
+                CharString_clear(&CommandProcessor_incomingCommand);
+                break;
+            case ']' :
+                commandMode = cpm_singleCommand;
+                CharString_clear(&CommandProcessor_incomingCommand);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// returns true if executing the command in CommandProcessor_incomingCommand
+// will produce a reply that has to be sent to the host
+static bool hostCommandHasReply (void)
+{
+    CharStringSpan_t cmd;
+    CharStringSpan_init(&CommandProcessor_incomingCommand, &cmd);
+    return hostCommandRejected ||
+        ((!CharStringSpan_isEmpty(&cmd)) &&
+         ((commandMode == cpm_commandBlock) ||
+          CommandProcessor_commandHasReply(&cmd)));
+}
+
+// executes the command in CommandProcessor_incomingCommand, if any
+static void executeHostCommand (
+    ReplyWriter_t *reply)
+{
+    if (hostCommandRejected) {
+        // tell the host that this command, and any after it, were lost
+        ReplyWriter_writeP(PSTR("ERROR command queue full\n"), reply);
+        hostCommandRejected = false;
+        return;
+    }
+    if (CharString_isEmpty(&CommandProcessor_incomingCommand)) {
+        return;
+    }
+
+    CharStringSpan_t cmd;
+    CharStringSpan_init(&CommandProcessor_incomingCommand, &cmd);
+    const uint16_t replyStart = ReplyWriter_length(reply);
+    const bool successful =
+        CommandProcessor_executeCommand(&cmd, reply);
+    if (ReplyWriter_length(reply) == replyStart) {
+        if (commandMode == cpm_commandBlock) {
+            // this will prompt the host for the next command
+            ReplyWriter_writeP(
+                successful
+                ? PSTR("OK\n")
+                : PSTR("ERROR\n"),
+                reply);
+        }
+    } else {
+        ReplyWriter_writeC('\n', reply);
+    }
+    CharString_clear(&CommandProcessor_incomingCommand);
+}
+
 static bool replyDataSender (void)
 {
     // RAMSentinel_printStackPtr();
 
-    // send as much as there is enough room in the output queue for a chunk of our data.
-    const uint16_t availableSpace = CellularTCPIP_availableSpaceForWriteData();
-    const uint8_t spaceInSpan =
-        (availableSpace > 255)
-        ? 255
-        : ((uint8_t)availableSpace);
-    CharStringSpan_t chunk;
-    CharStringSpan_extractLeft(spaceInSpan, &remainingReplyDataToSend, &chunk);
-    CellularTCPIP_writeDataCSS(&chunk);
-
-    return CharStringSpan_isEmpty(&remainingReplyDataToSend);
+    // replies are streamed straight into the output queue as the
+    // commands generate them
+    ReplyWriter_t reply;
+    ReplyWriter_initForStream(
+        CellularTCPIP_availableSpaceForWriteData,
+        CellularTCPIP_writeDataCSS,
+        &reply);
+
+    // execute the pending command, and then any commands the host has
+    // queued up behind it, sending their replies as part of this same
+    // upload rather than one send per command
+    executeHostCommand(&reply);
+    while ((numQueuedHostCommands > 0) &&
+           !SystemTime_shuttingDown()) {
+        popNextHostCommand();
+        executeHostCommand(&reply);
+    }
+
+    if (ReplyWriter_length(&reply) == 0) {
+        // the send has been started, so it has to have some data
+        ReplyWriter_writeC('\n', &reply);
+    }
+
+    return true;
 }
 
 static void TCPIPSendCompletionCallaback (
@@ -149,44 +420,71 @@ static void TCPIPSendCompletionCallaback (
         : sds_completedFailed;   
 }
 
+static void clearHostCommands (void)
+{
+    ByteQueue_clear(&hostCommandQueue);
+    numQueuedHostCommands = 0;
+    atStartOfHostCommand = true;
+    hostCommandOverflow = false;
+    discardingHostCommand = false;
+    hostCommandRejected = false;
+}
+
+// puts c on the host command queue, leaving room for an overflow marker.
+// returns false if there isn't room
+static bool queueHostCommandChar (
+    const char c)
+{
+    if (ByteQueue_spaceRemaining(&hostCommandQueue) > HOST_COMMAND_QUEUE_SPARE) {
+        ByteQueue_push(c, &hostCommandQueue);
+        return true;
+    }
+    return false;
+}
+
 static void IPDataCallback (
     const CharString_t *ipData)
 {
     // RAMSentinel_printStackPtr();
+    // queue up commands from the host. a whole block of commands
+    // may arrive at once
     for (int i = 0; i < CharString_length(ipData); ++i) {
         const char c = CharString_at(ipData, i);
-        if ((c == '\r') || (c == '\n')) {
-            // got command terminator
-            if (!CharString_isEmpty(&CommandProcessor_incomingCommand)) {
-                gotCommandFromHost = true;
-                if (CharString_length(&CommandProcessor_incomingCommand) == 1) {
-                    // check for mode command characters
-                    switch (CharString_at(&CommandProcessor_incomingCommand, 0)) {
-                        case '[' :
-                            commandMode = cpm_commandBlock;
-                            CharString_clear(&CommandProcessor_incomingCommand);
-                            break;
-                        case ']' :
-                            commandMode = cpm_singleCommand;
-                            CharString_clear(&CommandProcessor_incomingCommand);
-                            break;
-                        default:
-                            break;
-                    }
-                }
+        const bool isTerminator = (c == '\r') || (c == '\n');
+        if (hostCommandOverflow || discardingHostCommand) {
+            // drop commands until the one that overflowed has been
+            // taken off the queue
+            if (isTerminator) {
+                discardingHostCommand = false;
+            }
+            atStartOfHostCommand = isTerminator;
+        } else if (isTerminator && atStartOfHostCommand) {
+            // empty command
+        } else if (isTerminator
+                   ? queueHostCommandChar('\n')
+                   : queueHostCommandChar(c)) {
+            if (isTerminator) {
+                ++numQueuedHostCommands;
             }
+            atStartOfHostCommand = isTerminator;
         } else {
-            gotCommandFromHost = false;
-            CharString_appendC(c, &CommandProcessor_incomingCommand);
+            // the command doesn't fit. end what there is of it with the
+            // overflow marker so that it isn't executed
+            ByteQueue_push(HOST_COMMAND_OVERFLOW, &hostCommandQueue);
+            ByteQueue_push('\n', &hostCommandQueue);
+            ++numQueuedHostCommands;
+            hostCommandOverflow = true;
+            atStartOfHostCommand = isTerminator;
         }
     }
 }
 
 static void enableTCPIP (void)
 {
+    PostScheduler_sessionStarted();
+    sessionUploaded = false;
     CellularComm_Enable();
-    gotCommandFromHost = false;
-    CharString_clear(&CommandProcessor_incomingCommand);
+    clearHostCommands();
     commandMode = cpm_singleCommand;
     TCPIPConsole_setDataReceiver(IPDataCallback);
     TCPIPConsole_enable(false);
@@ -200,35 +498,35 @@ static bool updateWaterLevelState (
     bool needToReportLevel = false;
 
     // compute percentage full
-    const uint16_t emptyDistance = EEPROMStorage_waterTankEmptyDistance();
-    const uint16_t fullDistance = EEPROMStorage_waterTankFullDistance();
+    const uint16_t emptyDistance = SettingsShadow_waterTankEmptyDistance();
+    const uint16_t fullDistance = SettingsShadow_waterTankFullDistance();
     if (waterDistance >= emptyDistance) {
-        currentWaterLevelPercent = 0;
+        retained.currentWaterLevelPercent = 0;
     } else if (waterDistance <= fullDistance) {
-        currentWaterLevelPercent = 100;
+        retained.currentWaterLevelPercent = 100;
     } else {
         // pressure is between empty and full
         const uint16_t distanceRange = emptyDistance - fullDistance;
         uint32_t relativeDistance = emptyDistance - waterDistance;
-        currentWaterLevelPercent = (relativeDistance * 100) / distanceRange;
+        retained.currentWaterLevelPercent = (relativeDistance * 100) / distanceRange;
     }
 
-    WaterLevelState newState = currentWaterLevelState;
-    if (currentWaterLevelPercent >= EEPROMStorage_waterHighNotificationLevel()) {
+    WaterLevelState newState = retained.currentWaterLevelState;
+    if (retained.currentWaterLevelPercent >= SettingsShadow_waterHighNotificationLevel()) {
 	newState = wl_high;
-    } else if (currentWaterLevelPercent <= EEPROMStorage_waterLowNotificationLevel()) {
+    } else if (retained.currentWaterLevelPercent <= SettingsShadow_waterLowNotificationLevel()) {
 	newState = wl_low;
     } else {
-        switch (currentWaterLevelState) {
+        switch (retained.currentWaterLevelState) {
 	    case wl_low :
 	        // apply hysteresis
-	        if (currentWaterLevelPercent > (EEPROMStorage_waterLowNotificationLevel() + waterLevelDeadband)) {
+	        if (retained.currentWaterLevelPercent > (SettingsShadow_waterLowNotificationLevel() + waterLevelDeadband)) {
 		    newState = wl_inRange;
 	        }
 	        break;
 	    case wl_high :
 	        // apply hysteresis
-	        if (currentWaterLevelPercent < (EEPROMStorage_waterHighNotificationLevel() - waterLevelDeadband)) {
+	        if (retained.currentWaterLevelPercent < (SettingsShadow_waterHighNotificationLevel() - waterLevelDeadband)) {
 		    newState = wl_inRange;
 	        }
 	        break;
@@ -236,24 +534,27 @@ static bool updateWaterLevelState (
                 break;
         }
     }
-    if (newState != currentWaterLevelState) {
+    if (newState != retained.currentWaterLevelState) {
         // state changed
         switch (newState) {
 	    case wl_low     : Console_printP(PSTR("->Low"));    break;
 	    case wl_high    : Console_printP(PSTR("->High"));   break;
             case wl_inRange : Console_printP(PSTR("->Normal")); break;
         }
-        // report level if it has gone out of range
+        // report level if it has gone out of range. the host is alerted
+        // before the samples are sent
         needToReportLevel = (newState != wl_inRange);
+        retained.alertPending = needToReportLevel;
+        retained.alertTime = retained.lastSampleTime;
     }
-    currentWaterLevelState = newState;
+    retained.currentWaterLevelState = newState;
 
     if (!needToReportLevel) {
         // see if we need to report the level because it is increasing
         needToReportLevel =
-            (lastReportedWaterLevelPercent >= 0) && // we had successfully reported
-            (currentWaterLevelPercent >=
-            (lastReportedWaterLevelPercent + EEPROMStorage_levelIncreaseNotificationThreshold()));
+            (retained.lastReportedWaterLevelPercent >= 0) && // we had successfully reported
+            (retained.currentWaterLevelPercent >=
+            (retained.lastReportedWaterLevelPercent + SettingsShadow_levelIncreaseNotificationThreshold()));
     }
     
     return needToReportLevel;
@@ -261,14 +562,25 @@ static bool updateWaterLevelState (
 
 void initiatePowerdown (void)
 {
+    SystemTime_getCurrentTime(&teardownStartTime);
+    measuringTeardown = true;
+    SessionJournal_markPhase(sjp_send);
     // give it a little while to properly close the connection
-    SystemTime_futureTime(200, &time);
+    SystemTime_futureTime(TEARDOWN_CLOSE_TIMEOUT, &time);
     wlmState = wlms_delayBeforeDisable;
 }
 
 void transitionPerCommandMode(void)
 {
-    if (commandMode == cpm_commandBlock) {
+    if (awaitingAck) {
+        // an upload failed. wait for the host to tell us how much of it
+        // got through
+        wlmState = wlms_waitingForHostCommand;
+    } else if (resendSamples) {
+        // send the samples the host didn't get
+        resendSamples = false;
+        wlmState = wlms_waitingForConnection;
+    } else if (commandMode == cpm_commandBlock) {
         // more commands coming. wait for next command
         wlmState = wlms_waitingForHostCommand;
     } else {
@@ -277,16 +589,59 @@ void transitionPerCommandMode(void)
     }
 }
 
+static uint16_t retainedStateCRC (void)
+{
+    uint16_t crc = 0xFFFF;
+    const uint8_t *stateBytes = (const uint8_t*)&retained;
+    for (uint16_t i = 0; i < offsetof(RetainedState, crc); ++i) {
+        crc = _crc_ccitt_update(crc, stateBytes[i]);
+    }
+    return crc;
+}
+
+// must be called after each change to the retained state
+static void sealRetainedState (void)
+{
+    retained.crc = retainedStateCRC();
+}
+
+static void dropOldestSamples (
+    const uint8_t numSamples)
+{
+    const uint8_t numDropped =
+        (numSamples < SampleHistory_length(&retained.sampleHistory))
+        ? numSamples
+        : SampleHistory_length(&retained.sampleHistory);
+    SampleHistory_removeOldest(numDropped, &retained.sampleHistory);
+    retained.firstSampleSeq += numDropped;
+}
+
 void WaterLevelMonitor_Initialize (void)
 {
     wlmState = wlms_initial;
     commandMode = cpm_singleCommand;
-    SampleHistory_clear(&sampleHistory);
     dataSenderSampleIndex = -1;
-    currentWaterLevelState = wl_inRange;
-    gotCommandFromHost = false;
-    currentWaterLevelPercent = -1;      // unknown level
-    lastReportedWaterLevelPercent = -1; // unknown level
+    clearHostCommands();
+
+    retained.sampleHistory.capacity = SAMPLE_HISTORY_LEN;
+    retained.sampleHistory.sampleBuffer = retained.sampleBuffer;
+    if ((SystemTime_LastReboot() == lrb_software) &&
+        (retained.version == SW_VERSION) &&
+        (retained.crc == retainedStateCRC())) {
+        // carry on with the samples and level state we had before the reboot
+        Console_printP(PSTR("restored retained state"));
+    } else {
+        retained.version = SW_VERSION;
+        const uint16_t bootCount = SystemTime_countColdBoot();
+        retained.firstSampleSeq =
+            ((uint32_t)(bootCount & SEQ_BOOT_COUNT_MASK)) << SEQ_BOOT_COUNT_SHIFT;
+        SampleHistory_clear(&retained.sampleHistory);
+        retained.currentWaterLevelState = wl_inRange;
+        retained.currentWaterLevelPercent = -1;      // unknown level
+        retained.lastReportedWaterLevelPercent = -1; // unknown level
+        retained.alertPending = false;
+        sealRetainedState();
+    }
 }
 
 void WaterLevelMonitor_task (void)
@@ -311,16 +666,18 @@ void WaterLevelMonitor_task (void)
             PORTC |= (1 << PC1);
 
             // determine if it's time to log to server
-            const uint16_t sampleInterval = EEPROMStorage_sampleInterval();
-            const uint16_t logInterval = EEPROMStorage_LoggingUpdateInterval();
-            SystemTime_getCurrentTime(&time);
-            if (((time.seconds + (sampleInterval / 2)) % logInterval) < sampleInterval) {
-                // time to log to server
+            if (PostScheduler_postIsDue()) {
                 enableTCPIP();
             }
 
+            uploadAttempts = 0;
+            awaitingAck = false;
+            resendSamples = false;
+            alertTried = false;
+            alertLatency = 0;
+
             // set up overal task timeout
-            SystemTime_futureTime(EEPROMStorage_monitorTaskTimeout() * 100, &time);
+            SystemTime_futureTime(SettingsShadow_monitorTaskTimeout() * 100, &time);
 
             wlmState = wlms_waitingForSensorData;
             break;
@@ -332,21 +689,26 @@ void WaterLevelMonitor_task (void)
                 SampleHistory_Sample sample;
                 SystemTime_t curTime;
                 SystemTime_getCurrentTime(&curTime);
-                if (SampleHistory_empty(&sampleHistory)) {
+                if (SampleHistory_length(&retained.sampleHistory) == SAMPLE_HISTORY_LEN) {
+                    // oldest sample is about to be overwritten
+                    ++retained.firstSampleSeq;
+                }
+                if (SampleHistory_empty(&retained.sampleHistory)) {
                     sample.relSampleTime = 0;
                 } else {
                     const int32_t secondsSinceLastSample =
-                        SystemTime_diffSec(&curTime, &lastSampleTime);
+                        SystemTime_diffSec(&curTime, &retained.lastSampleTime);
                     sample.relSampleTime = secondsSinceLastSample;
                 }
-                lastSampleTime = curTime;
+                retained.lastSampleTime = curTime;
                 sample.temperature =
                     (uint8_t)InternalTemperatureMonitor_currentTemperature();
                 sample.waterDistance = UltrasonicSensorMonitor_currentDistance();
-                SampleHistory_insertSample(&sample, &sampleHistory);
+                SampleHistory_insertSample(&sample, &retained.sampleHistory);
 
                 const bool needToReportLevel = 
                     updateWaterLevelState(sample.waterDistance / 10);   // cvt mm to cm
+                sealRetainedState();
     
                 if (TCPIPConsole_isEnabled()) {
                     wlmState = wlms_waitingForConnection;
@@ -363,64 +725,119 @@ void WaterLevelMonitor_task (void)
             }
             break;
         case wlms_waitingForConnection :
-            if (TCPIPConsole_readyToSend()) {
+            if (PostScheduler_shouldAbandonSession()) {
+                // not worth trying any longer. the scheduler will retry
+                Console_printP(PSTR("session abandoned"));
+                initiatePowerdown();
+            } else if (TCPIPConsole_readyToSend() &&
+                       retained.alertPending && !alertTried) {
+                // the alert goes out first, on its own, so that the host
+                // hears about the level without waiting for the samples
+                alertTried = true;
+                sendDataStatus = sds_sending;
+                TCPIPConsole_sendData(alertDataSender, TCPIPSendCompletionCallaback);
+                wlmState = wlms_sendingAlert;
+            } else if (TCPIPConsole_readyToSend()) {
                 sendDataStatus = sds_sending;
                 dataSenderSampleIndex = -1; // start with per-post data
+                ++uploadAttempts;
                 TCPIPConsole_sendData(sampleDataSender, TCPIPSendCompletionCallaback);
                 wlmState = wlms_sendingSampleData;
             }
             break;
+        case wlms_sendingAlert :
+            switch (sendDataStatus) {
+                case sds_sending :
+                    break;
+                case sds_completedSuccessfully : {
+                    SystemTime_t curTime;
+                    SystemTime_getCurrentTime(&curTime);
+                    const int32_t tenths =
+                        (SystemTime_diffSec(&curTime, &retained.alertTime) * 10) +
+                        (((int16_t)curTime.hundredths - (int16_t)retained.alertTime.hundredths) / 10);
+                    // (0 means no alert was sent)
+                    alertLatency = (tenths > 65535L)
+                        ? 0xFFFF
+                        : (uint16_t)((tenths < 1) ? 1 : tenths);
+                    Console_printP(PSTR("alert sent"));
+                    retained.alertPending = false;
+                    retained.lastReportedWaterLevelPercent = retained.currentWaterLevelPercent;
+                    sealRetainedState();
+                    // go on to send the samples
+                    wlmState = wlms_waitingForConnection;
+                    }
+                    break;
+                case sds_completedFailed :
+                    // the samples carry the level too. the alert is tried
+                    // again in the next session if they don't get through
+                    wlmState = wlms_waitingForConnection;
+                    break;
+            }
+            break;
         case wlms_sendingSampleData :
             switch (sendDataStatus) {
                 case sds_sending :
                     break;
                 case sds_completedSuccessfully :
-                    SampleHistory_clear(&sampleHistory);
-                    lastReportedWaterLevelPercent = currentWaterLevelPercent;
-                    wlmState = wlms_waitingForHostCommand;
+                    SessionJournal_noteUploaded();
+                    sessionUploaded = true;
+                    dropOldestSamples(dataSenderSampleIndex);
+                    retained.lastReportedWaterLevelPercent = retained.currentWaterLevelPercent;
+                    retained.alertPending = false;
+                    sealRetainedState();
+                    if (uploadAttempts > 1) {
+                        // the host's first command was handled after the
+                        // failed attempt
+                        transitionPerCommandMode();
+                    } else {
+                        wlmState = wlms_waitingForHostCommand;
+                    }
                     break;
                 case sds_completedFailed :
+                    // the host may have got part of the upload. it will
+                    // say how much with an ack command
+                    awaitingAck = true;
+                    resendSamples = (uploadAttempts < MAX_UPLOAD_ATTEMPTS);
+                    SystemTime_futureTime(ACK_TIMEOUT, &ackDeadline);
                     wlmState = wlms_waitingForHostCommand;
                     break;
             }
             break;
         case wlms_waitingForHostCommand:
-            if (gotCommandFromHost) {
-                gotCommandFromHost = false;
-                CharString_clear(&CommandProcessor_commandReply);
-                if (!CharString_isEmpty(&CommandProcessor_incomingCommand)) {
-                    CharStringSpan_t cmd;
-                    CharStringSpan_init(&CommandProcessor_incomingCommand, &cmd);
-                    const bool successful =
-                        CommandProcessor_executeCommand(&cmd, &CommandProcessor_commandReply);
-                    CharString_clear(&CommandProcessor_incomingCommand);
-                    if (CharString_isEmpty(&CommandProcessor_commandReply)) {
-                        if (commandMode == cpm_commandBlock) {
-                            // this will prompt the host for the next command
-                            CharString_copyP(
-                                successful
-                                ? PSTR("OK\n")
-                                : PSTR("ERROR\n"),
-                                &CommandProcessor_commandReply);
-                        }
-                    } else {
-                        CharString_appendC('\n', &CommandProcessor_commandReply);
+            if (numQueuedHostCommands > 0) {
+                // execute queued commands that don't have a reply back-to-back.
+                // the first command that has a reply is left pending, to be
+                // executed, along with the commands queued up behind it, when
+                // its upload starts
+                ReplyWriter_t noReply;
+                ReplyWriter_initNull(&noReply);
+                do {
+                    popNextHostCommand();
+                    if (hostCommandHasReply()) {
+                        break;
                     }
-                }
+                    executeHostCommand(&noReply);
+                } while ((numQueuedHostCommands > 0) &&
+                         !SystemTime_shuttingDown());
                 if (SystemTime_shuttingDown()) {
                     initiatePowerdown();
-                } else if (CharString_isEmpty(&CommandProcessor_commandReply)) {
+                } else if (!hostCommandHasReply()) {
                     transitionPerCommandMode();
                 } else {
                     // prepare to send reply
                     wlmState = wlms_waitingForReadyToSendReply;
                 }
+            } else if (awaitingAck &&
+                       SystemTime_timeHasArrived(&ackDeadline)) {
+                // the host didn't say how much of the failed upload it got.
+                // if we send again it will discard what it already has
+                awaitingAck = false;
+                transitionPerCommandMode();
             }
             break;
         case wlms_waitingForReadyToSendReply :
             if (TCPIPConsole_readyToSend()) {
                 sendDataStatus = sds_sending;
-                CharStringSpan_init(&CommandProcessor_commandReply, &remainingReplyDataToSend);
                 TCPIPConsole_sendData(replyDataSender, TCPIPSendCompletionCallaback);
                 wlmState = wlms_sendingReplyData;
             }
@@ -431,31 +848,61 @@ void WaterLevelMonitor_task (void)
                     break;
                 case sds_completedSuccessfully :
                 case sds_completedFailed :
-                    transitionPerCommandMode();
+                    if (SystemTime_shuttingDown()) {
+                        initiatePowerdown();
+                    } else {
+                        transitionPerCommandMode();
+                    }
                     break;
             }
             break;
         case wlms_delayBeforeDisable :
-            if (SystemTime_timeHasArrived(&time)) {
+            if ((!CellularTCPIP_hasSubtaskWorkToDo()) ||
+                SystemTime_timeHasArrived(&time)) {
                 TCPIPConsole_disable(false);
-                CellularComm_Disable();
-                // give the cell module another three seconds to properly close the connection
-                SystemTime_futureTime(200, &time);
+                if (CellularComm_sleepIsCheaper(PostScheduler_secondsUntilNextPost())) {
+                    CellularComm_Sleep();
+                } else {
+                    CellularComm_Disable();
+                }
+                SystemTime_futureTime(TEARDOWN_DISABLE_TIMEOUT, &time);
                 wlmState = wlms_waitingForCellularCommDisable;
             }
             break;
         case wlms_waitingForCellularCommDisable :
-            if ((!CellularComm_isEnabled()) ||
-                SystemTime_timeHasArrived(&time)) {
-                SystemTime_futureTime(50, &time);
+            if (!CellularComm_isEnabled()) {
+                // the cell module is off (or asleep)
+                SystemTime_getCurrentTime(&time);
+                wlmState = wlms_poweringDown;
+            } else if (SystemTime_timeHasArrived(&time)) {
+                SystemTime_futureTime(TEARDOWN_POWER_CUT_DELAY, &time);
                 wlmState = wlms_poweringDown;
             }
             break;
         case wlms_poweringDown :
             if (SystemTime_timeHasArrived(&time)) {
-                // power down peripherals
-                DDRC |= (1 << PC1);
-                PORTC &= ~(1 << PC1);
+                // power down peripherals, unless the cell module is
+                // sleeping on them
+                if (!CellularComm_isSleeping()) {
+                    DDRC |= (1 << PC1);
+                    PORTC &= ~(1 << PC1);
+                }
+
+                SessionJournal_markPhase(sjp_teardown);
+                SessionJournal_endSession();
+                PostScheduler_sessionEnded(sessionUploaded);
+
+                if (measuringTeardown) {
+                    measuringTeardown = false;
+                    SystemTime_t curTime;
+                    SystemTime_getCurrentTime(&curTime);
+                    const int32_t hundredths =
+                        (SystemTime_diffSec(&curTime, &teardownStartTime) * 100) +
+                        ((int16_t)curTime.hundredths - (int16_t)teardownStartTime.hundredths);
+                    lastTeardownTime = (hundredths > 65535L)
+                        ? 0xFFFF
+                        : (uint16_t)hundredths;
+                }
 
                 wlmState = wlms_done;
             }
@@ -480,7 +927,21 @@ bool WaterLevelMonitor_taskIsDone (void)
 
 bool WaterLevelMonitor_hasSampleData (void)
 {
-    return !SampleHistory_empty(&sampleHistory);
+    return !SampleHistory_empty(&retained.sampleHistory);
+}
+
+void WaterLevelMonitor_acknowledgeSamples (
+    const uint32_t lastSeq)
+{
+    if (lastSeq >= retained.firstSampleSeq) {
+        const uint32_t numAcknowledged = (lastSeq - retained.firstSampleSeq) + 1;
+        dropOldestSamples(
+            (numAcknowledged < SAMPLE_HISTORY_LEN)
+            ? numAcknowledged
+            : SAMPLE_HISTORY_LEN);
+        sealRetainedState();
+    }
+    awaitingAck = false;
 }
 
 void WaterLevelMonitor_resume (void)
@@ -15,6 +15,7 @@ typedef enum WaterLevelMonitorState_enum {
     wlms_resuming,
     wlms_waitingForSensorData,
     wlms_waitingForConnection,
+    wlms_sendingAlert,
     wlms_sendingSampleData,
     wlms_waitingForHostCommand,
     wlms_waitingForReadyToSendReply,
@@ -37,6 +38,11 @@ extern void WaterLevelMonitor_extendTaskTimeout(
 extern bool WaterLevelMonitor_taskIsDone (void);
 extern bool WaterLevelMonitor_hasSampleData (void);
 
+// the host has received all samples up to and including sequence
+// number lastSeq
+extern void WaterLevelMonitor_acknowledgeSamples (
+    const uint32_t lastSeq);
+
 extern void WaterLevelMonitor_resume (void);
 
 extern WaterLevelMonitorState WaterLevelMonitor_state (void);
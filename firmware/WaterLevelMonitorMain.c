@@ -12,6 +12,7 @@
 #include "intlimit.h"
 #include "SystemTime.h"
 #include "EEPROMStorage.h"
+#include "SettingsShadow.h"
 #include "ADCManager.h"
 #include "BatteryMonitor.h"
 #include "Console.h"
@@ -27,9 +28,21 @@
 #include "SoftwareSerialTx.h"
 #include "WaterLevelMonitor.h"
 #include "RAMSentinel.h"
+#include "ScratchArena.h"
+#include "ATLatency.h"
 
 #define WATCHDOG_TIMEOUT WDTO_500MS
 
+// runs a task, releases the scratch it used, and then checks whether it
+// took the stack deeper than it has been before. tasks are numbered in the
+// order they run in the main loop, and that number is what's reported as
+// the task that used the most stack (0 is initialization, 12 is sleeping
+// and waking up)
+#define RUN_TASK(taskID, task) \
+    task(); \
+    ScratchArena_releaseTaskScratch(); \
+    RAMSentinel_checkStack(taskID);
+
 static void Initialize (void)
 {
     // enable watchdog timer
@@ -37,6 +50,9 @@ static void Initialize (void)
 
     EEPROMStorage_Initialize();
     SystemTime_Initialize();
+    SettingsShadow_Initialize();
+    ScratchArena_Initialize();
+    ATLatency_Initialize();
     ADCManager_Initialize();
     BatteryMonitor_Initialize();
     InternalTemperatureMonitor_Initialize();
@@ -65,23 +81,24 @@ int main (void)
         }
 
         // run all the tasks
-        SystemTime_task();
-        ADCManager_task();
-        BatteryMonitor_task();
-        InternalTemperatureMonitor_task();
-        UltrasonicSensorMonitor_task();
-        SIM800_task();
-        Console_task();
-        TCPIPConsole_task();
-        CellularComm_task();
-        WaterLevelMonitor_task();
+        RUN_TASK(1, SystemTime_task)
+        RUN_TASK(2, SettingsShadow_task)
+        RUN_TASK(3, ADCManager_task)
+        RUN_TASK(4, BatteryMonitor_task)
+        RUN_TASK(5, InternalTemperatureMonitor_task)
+        RUN_TASK(6, UltrasonicSensorMonitor_task)
+        RUN_TASK(7, SIM800_task)
+        RUN_TASK(8, Console_task)
+        RUN_TASK(9, TCPIPConsole_task)
+        RUN_TASK(10, CellularComm_task)
+        RUN_TASK(11, WaterLevelMonitor_task)
 
         if (WaterLevelMonitor_taskIsDone() &&
             !SystemTime_shuttingDown()) {
 
             const uint32_t uptime = SystemTime_uptime();
             const uint32_t rebootIntervalSeconds =
-                ((uint32_t)EEPROMStorage_rebootInterval()) * 60;
+                ((uint32_t)SettingsShadow_rebootInterval()) * 60;
             if ((uptime >= rebootIntervalSeconds) &&
                 !WaterLevelMonitor_hasSampleData()) {   // wait until sample data transmitted
                 SystemTime_commenceShutdown();
@@ -97,11 +114,19 @@ int main (void)
                 DIDR1 = 3;
                 // turn off all pullups
                 PORTB = 0;
-                PORTC = 0;
-                PORTD = 0;
+                if (CellularComm_isSleeping()) {
+                    // keep peripheral power on and the cell module's
+                    // serial input idle, and ignore what it sends
+                    SoftwareSerialRx2_disable();
+                    PORTC = (1 << PC1);
+                    PORTD = (1 << PD4);
+                } else {
+                    PORTC = 0;
+                    PORTD = 0;
+                }
 
                 // compute how long to sleep until the next sample
-                const uint16_t sampleInterval = EEPROMStorage_sampleInterval();
+                const uint16_t sampleInterval = SettingsShadow_sampleInterval();
                 SystemTime_t curTime;
                 SystemTime_getCurrentTime(&curTime);
                 SystemTime_t nextSampleTime;
@@ -133,6 +158,7 @@ int main (void)
                 TCPIPConsole_Initialize();
 
                 WaterLevelMonitor_resume();
+                RAMSentinel_checkStack(12);
             }
         }
 
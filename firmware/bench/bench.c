@@ -0,0 +1,354 @@
+//
+//  Microbenchmarks for the string and queue primitives
+//
+//  Each benchmark runs its body BENCH_ITERATIONS times and reports the
+//  cost of one run of the body, one line per benchmark:
+//      <name> <cost>
+//  On the AVR (run under simavr) the cost is in CPU cycles, counted with
+//  Timer1 running at the CPU clock. On the host it is in nanoseconds.
+//  AVR cycle counts are deterministic, so they are what the regression
+//  gate compares against the baseline (see Makefile).
+//
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <avr/pgmspace.h>
+
+#include "CharString.h"
+#include "CharStringSpan.h"
+#include "StringUtils.h"
+#include "ByteQueue.h"
+#include "DataHistory.h"
+
+#if defined(__AVR__)
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/sleep.h>
+#include "avr_mcu_section.h"
+
+// simavr prints what is written to GPIOR0
+AVR_MCU(F_CPU, "atmega328p");
+AVR_MCU_SIMAVR_CONSOLE(&GPIOR0);
+
+#define BENCH_ITERATIONS 100
+
+static volatile uint16_t timerOverflows;
+
+ISR(TIMER1_OVF_vect)
+{
+    ++timerOverflows;
+}
+
+static void startClock (void)
+{
+    TCCR1A = 0;
+    TCCR1B = (1 << CS10);   // count CPU clocks
+    TIMSK1 = (1 << TOIE1);
+    sei();
+}
+
+static uint32_t clockNow (void)
+{
+    cli();
+    uint16_t count = TCNT1;
+    uint16_t overflows = timerOverflows;
+    if ((TIFR1 & (1 << TOV1)) && (count < 0x8000)) {
+        // overflowed since interrupts were disabled
+        ++overflows;
+    }
+    sei();
+    return (((uint32_t)overflows) << 16) | count;
+}
+
+static void writeChar (
+    const char ch)
+{
+    GPIOR0 = ch;
+}
+
+static void finish (void)
+{
+    // simavr exits when the CPU sleeps with interrupts disabled
+    cli();
+    sleep_cpu();
+}
+
+#else
+
+#include <stdio.h>
+#include <time.h>
+
+#define BENCH_ITERATIONS 1000000L
+
+// status register stand-in for the interrupt guards in ByteQueue.h
+uint8_t SREG;
+
+static void startClock (void)
+{
+}
+
+static uint32_t clockNow (void)
+{
+    // microseconds are enough resolution, since costs are scaled to
+    // one run of the body below
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint32_t)((now.tv_sec * 1000000L) + (now.tv_nsec / 1000));
+}
+
+static void writeChar (
+    const char ch)
+{
+    putchar(ch);
+}
+
+static void finish (void)
+{
+}
+
+#endif
+
+static void report (
+    PGM_P name,
+    const uint32_t totalCost)
+{
+    CharString_define(40, line);
+    CharString_copyP(name, &line);
+    CharString_appendC(' ', &line);
+#if defined(__AVR__)
+    StringUtils_appendDecimal32(totalCost / BENCH_ITERATIONS, 1, 0, &line);
+#else
+    // totalCost is in microseconds for 1e6 runs, i.e. 1/1000ths of ns
+    // per run
+    StringUtils_appendDecimal32(totalCost / 100, 1, 1, &line);
+#endif
+    CharString_appendC('\n', &line);
+    for (CharString_Iter iter = CharString_begin(&line);
+        iter != CharString_end(&line); ++iter) {
+        writeChar(*iter);
+    }
+}
+
+// keeps results alive so that the compiler can't discard the work
+static volatile uint32_t sink;
+
+#define BENCHMARK(name, setup, body) \
+    { \
+        setup; \
+        const uint32_t start = clockNow(); \
+        for (long i = 0; i < BENCH_ITERATIONS; ++i) { \
+            body; \
+        } \
+        const uint32_t elapsed = clockNow() - start; \
+        report(PSTR(name), \
+            (elapsed > loopOverhead) ? (elapsed - loopOverhead) : 0); \
+    }
+
+static const char sampleText[] = "W1490T20;D600";
+static const char commandLine[] = "set sampleInterval 600";
+
+static char ackP[]      PROGMEM = "ack";
+static char eedumpP[]   PROGMEM = "eedump";
+static char getP[]      PROGMEM = "get";
+static char rebootP[]   PROGMEM = "reboot";
+static char setP[]      PROGMEM = "set";
+static char statusP[]   PROGMEM = "status";
+static char tsetP[]     PROGMEM = "tset";
+// table must be maintained in case-insensitive ASCII collation order
+static PGM_P commandNames[] PROGMEM =
+{
+    ackP, eedumpP, getP, rebootP, setP, statusP, tsetP
+};
+
+// decimal conversion as StringUtils did it before it stopped calling the
+// library division, to compare StringUtils_appendDecimal* against
+static __attribute__((noinline)) void appendDecimal_libdiv (
+    const int16_t value,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    CharString_t* destStr)
+{
+    char strBuffer[16];
+    char* cp = &strBuffer[15];
+    *cp-- = 0;  // null terminate
+
+    uint16_t workingValue = (value < 0) ? -value : value;
+    if (numFractionalDigits > 0) {
+        for (int f = 0; f < numFractionalDigits; ++f) {
+            *cp-- = (workingValue % 10) + '0';
+            workingValue /= 10;
+        }
+        *cp-- = '.';
+    }
+    for (int i = 0; (i < minIntegerDigits) || (workingValue != 0); ++i) {
+        *cp-- = (workingValue % 10) + '0';
+        workingValue /= 10;
+    }
+    if (value < 0) {
+        *cp-- = '-';
+    }
+    CharString_append(cp+1, destStr);
+}
+
+static __attribute__((noinline)) void appendDecimal32_libdiv (
+    const int32_t value,
+    const uint8_t minIntegerDigits,
+    const uint8_t numFractionalDigits,
+    CharString_t* destStr)
+{
+    char strBuffer[16];
+    char* cp = &strBuffer[15];
+    *cp-- = 0;  // null terminate
+
+    uint32_t workingValue = (value < 0) ? -value : value;
+    if (numFractionalDigits > 0) {
+        for (int f = 0; f < numFractionalDigits; ++f) {
+            *cp-- = (workingValue % 10) + '0';
+            workingValue /= 10;
+        }
+        *cp-- = '.';
+    }
+    for (int i = 0; (i < minIntegerDigits) || (workingValue != 0); ++i) {
+        *cp-- = (workingValue % 10) + '0';
+        workingValue /= 10;
+    }
+    if (value < 0) {
+        *cp-- = '-';
+    }
+    CharString_append(cp+1, destStr);
+}
+
+ByteQueue_define(64, queue, static);
+DataHistory_define(16, dataHistory);
+
+int main (void)
+{
+    startClock();
+
+    // cost of the benchmark loop itself
+    uint32_t loopOverhead = 0;
+    {
+        const uint32_t start = clockNow();
+        for (long i = 0; i < BENCH_ITERATIONS; ++i) {
+            sink = i;
+        }
+        loopOverhead = clockNow() - start;
+    }
+
+    CharString_define(80, str);
+    CharString_define(20, digits);
+    CharStringSpan_t span;
+    CharStringSpan_t rest;
+    bool isValid;
+    int16_t value16;
+    uint32_t value32;
+    uint8_t fractionalDigits;
+
+    BENCHMARK("CharString_appendC_x40",
+        CharString_clear(&str),
+        CharString_clear(&str);
+        for (uint8_t c = 0; c < 40; ++c) {
+            CharString_appendC('a' + (c & 15), &str);
+        }
+        sink = CharString_length(&str))
+
+    BENCHMARK("CharString_append",
+        CharString_clear(&str),
+        CharString_clear(&str);
+        CharString_append(sampleText, &str);
+        sink = CharString_length(&str))
+
+    BENCHMARK("CharString_appendP",
+        CharString_clear(&str),
+        CharString_clear(&str);
+        CharString_appendP(PSTR("+CIPSEND: 0,1460"), &str);
+        sink = CharString_length(&str))
+
+    BENCHMARK("CharStringSpan_equalsNocaseP",
+        CharString_copy(commandLine, &str);
+        CharStringSpan_init(&str, &rest); StringUtils_scanToken(&rest, &span),
+        sink = CharStringSpan_equalsNocaseP(&span, PSTR("SET")))
+
+    BENCHMARK("CharStringSpan_compareNocaseP",
+        CharString_copy(commandLine, &str);
+        CharStringSpan_init(&str, &rest); StringUtils_scanToken(&rest, &span),
+        sink = CharStringSpan_compareNocaseP(&span, PSTR("status")))
+
+    BENCHMARK("StringUtils_scanToken",
+        CharString_copy(commandLine, &str),
+        CharStringSpan_t cmd;
+        CharStringSpan_t token;
+        CharStringSpan_init(&str, &cmd);
+        StringUtils_scanToken(&cmd, &token);
+        StringUtils_scanToken(&cmd, &token);
+        StringUtils_scanToken(&cmd, &token);
+        sink = CharStringSpan_length(&token))
+
+    BENCHMARK("StringUtils_lookupNameNocase",
+        CharString_copy(commandLine, &str);
+        CharStringSpan_init(&str, &rest); StringUtils_scanToken(&rest, &span),
+        sink = StringUtils_lookupNameNocase(&span, commandNames,
+            sizeof(PGM_P), sizeof(commandNames) / sizeof(PGM_P)))
+
+    BENCHMARK("StringUtils_scanInteger",
+        CharString_copy("12345", &digits); CharStringSpan_init(&digits, &span),
+        StringUtils_scanInteger(&span, &isValid, &value16, NULL);
+        sink = value16)
+
+    BENCHMARK("StringUtils_scanIntegerU32",
+        CharString_copy("1300000000", &digits); CharStringSpan_init(&digits, &span),
+        StringUtils_scanIntegerU32(&span, &isValid, &value32, NULL);
+        sink = value32)
+
+    BENCHMARK("StringUtils_scanDecimal",
+        CharString_copy("-12.34", &digits); CharStringSpan_init(&digits, &span),
+        StringUtils_scanDecimal(&span, &isValid, &value16, &fractionalDigits, NULL);
+        sink = value16)
+
+    BENCHMARK("StringUtils_appendDecimal",
+        CharString_clear(&digits),
+        CharString_clear(&digits);
+        StringUtils_appendDecimal(4123, 1, 2, &digits);
+        sink = CharString_length(&digits))
+
+    BENCHMARK("appendDecimal_libdiv",
+        CharString_clear(&digits),
+        CharString_clear(&digits);
+        appendDecimal_libdiv(4123, 1, 2, &digits);
+        sink = CharString_length(&digits))
+
+    BENCHMARK("StringUtils_appendDecimal32",
+        CharString_clear(&digits),
+        CharString_clear(&digits);
+        StringUtils_appendDecimal32(1300000000L, 1, 0, &digits);
+        sink = CharString_length(&digits))
+
+    BENCHMARK("appendDecimal32_libdiv",
+        CharString_clear(&digits),
+        CharString_clear(&digits);
+        appendDecimal32_libdiv(1300000000L, 1, 0, &digits);
+        sink = CharString_length(&digits))
+
+    BENCHMARK("ByteQueue_push_pop_x32",
+        ByteQueue_clear(&queue),
+        for (uint8_t b = 0; b < 32; ++b) {
+            ByteQueue_push(b, &queue);
+        }
+        while (!ByteQueue_is_empty(&queue)) {
+            sink = ByteQueue_pop(&queue);
+        })
+
+    BENCHMARK("DataHistory_getStatistics_16",
+        for (uint8_t v = 0; v < 16; ++v) {
+            DataHistory_insertValue(1000 + (v * 7), &dataHistory);
+        },
+        uint16_t min;
+        uint16_t max;
+        uint16_t avg;
+        DataHistory_getStatistics(&dataHistory, 16, &min, &max, &avg);
+        sink = avg)
+
+    finish();
+    return 0;
+}
@@ -0,0 +1,47 @@
+#!/bin/sh
+#
+#  compare.sh <baseline> <results> <threshold-percent>
+#
+#  Compares benchmark results against the baseline, one "name value"
+#  line per benchmark ('#' lines are ignored). Exits non-zero if any
+#  benchmark is more than threshold-percent slower than its baseline, or
+#  if a benchmark is missing from either file (record a new baseline with
+#  'make baseline' after adding or removing benchmarks).
+#
+
+awk -v threshold="$3" '
+    /^#/ || NF < 2 { next }
+    FNR == NR { baseline[$1] = $2; ++numBaseline; next }
+    {
+        seen[$1] = 1
+        if (!($1 in baseline)) {
+            printf "%-32s %10s -> %10d   NO BASELINE\n", $1, "-", $2
+            ++failures
+            next
+        }
+        old = baseline[$1]
+        change = (old > 0) ? (100.0 * ($2 - old) / old) : 0
+        status = ""
+        if (change > threshold) {
+            status = "REGRESSION"
+            ++failures
+        }
+        printf "%-32s %10d -> %10d %+6.1f%% %s\n", $1, old, $2, change, status
+    }
+    END {
+        for (name in baseline) {
+            if (!(name in seen)) {
+                printf "%-32s %10d -> %10s   NOT RUN\n", name, baseline[name], "-"
+                ++failures
+            }
+        }
+        if (numBaseline == 0) {
+            print "no baseline recorded. run make baseline and commit baseline-avr.txt"
+            exit 1
+        }
+        if (failures > 0) {
+            printf "%d benchmark(s) failed against the baseline (threshold %s%%)\n", failures, threshold
+            exit 1
+        }
+    }
+' "$1" "$2"
@@ -0,0 +1,12 @@
+//
+//  Host stand-in for avr/interrupt.h
+//
+#ifndef BENCH_HOST_INTERRUPT_H
+#define BENCH_HOST_INTERRUPT_H
+
+#include "avr/io.h"
+
+#define cli()
+#define sei()
+
+#endif  // BENCH_HOST_INTERRUPT_H
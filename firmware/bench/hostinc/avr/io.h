@@ -0,0 +1,11 @@
+//
+//  Host stand-in for avr/io.h
+//
+#ifndef BENCH_HOST_IO_H
+#define BENCH_HOST_IO_H
+
+#include <stdint.h>
+
+extern uint8_t SREG;
+
+#endif  // BENCH_HOST_IO_H
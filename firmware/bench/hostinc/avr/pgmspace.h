@@ -0,0 +1,31 @@
+//
+//  Host stand-in for avr/pgmspace.h
+//
+//  Program memory is ordinary memory on the host, so the _P functions
+//  map onto their standard library counterparts.
+//
+#ifndef BENCH_HOST_PGMSPACE_H
+#define BENCH_HOST_PGMSPACE_H
+
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+typedef const char *PGM_P;
+typedef char prog_char;
+typedef uint8_t prog_uint8_t;
+
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#define pgm_read_word(addr) (*(const uintptr_t *)(addr))
+
+#define strcmp_P        strcmp
+#define strlen_P        strlen
+#define strncasecmp_P   strncasecmp
+#define strncmp_P       strncmp
+#define strncpy_P       strncpy
+#define strstr_P        strstr
+#define memcpy_P        memcpy
+
+#endif  // BENCH_HOST_PGMSPACE_H
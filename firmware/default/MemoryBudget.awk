@@ -0,0 +1,195 @@
+#
+#  MemoryBudget.awk
+#
+#  What it does:
+#    Breaks the linked image down per object file into .text, PROGMEM,
+#    .data, .bss, .noinit and .eeprom, lists the largest symbols, and
+#    checks both against the budgets file. Exits with status 1 if any
+#    budget is exceeded.
+#
+#  Usage:
+#    avr-nm -S -t d --size-sort WaterLevelMonitor.elf > WaterLevelMonitor.sym
+#    awk -f MemoryBudget.awk MemoryBudget.txt WaterLevelMonitor.map WaterLevelMonitor.sym
+#
+#  Budgets file lines are "<name> <flash> <ram>", where name is TOTAL,
+#  an object file or a symbol, and '-' means the limit is not checked.
+#  Flash counts .text, PROGMEM and the .data initializers; RAM counts
+#  .data, .bss and .noinit.
+#
+
+# symbols at least this large are listed in the report
+BEGIN {
+    ramSymbolMin = 16
+    flashSymbolMin = 512
+}
+
+function hexValue (s,    i, v)
+{
+    s = tolower(s)
+    sub(/^0x/, "", s)
+    v = 0
+    for (i = 1; i <= length(s); ++i) {
+        v = (v * 16) + index("0123456789abcdef", substr(s, i, 1)) - 1
+    }
+    return v
+}
+
+# libc.a(strlen_P.o) -> libc.a, c:/.../crtm328p.o -> crtm328p.o
+function moduleName (path)
+{
+    sub(/\(.*\)$/, "", path)
+    sub(/.*[\/\\]/, "", path)
+    return path
+}
+
+function addInputSection (section, size, path,    m, kind)
+{
+    if (size == 0 || path == "linker stubs") {
+        return
+    }
+    if (section ~ /^\.progmem/) {
+        kind = "progmem"
+    } else if (outputSection == ".text") {
+        kind = "text"
+    } else if (outputSection == ".data") {
+        kind = "data"
+    } else if (outputSection == ".bss") {
+        kind = "bss"
+    } else if (outputSection == ".noinit") {
+        kind = "noinit"
+    } else if (outputSection == ".eeprom") {
+        kind = "eeprom"
+    } else {
+        return
+    }
+    m = moduleName(path)
+    if (!(m in seen)) {
+        seen[m] = 1
+        modules[++numModules] = m
+    }
+    usage[m, kind] += size
+    usage["TOTAL", kind] += size
+}
+
+function flashOf (m)
+{
+    return usage[m, "text"] + usage[m, "progmem"] + usage[m, "data"]
+}
+
+function ramOf (m)
+{
+    return usage[m, "data"] + usage[m, "bss"] + usage[m, "noinit"]
+}
+
+function checkBudget (name, kind, used,    limit)
+{
+    limit = (kind == "flash") ? flashBudget[name] : ramBudget[name]
+    if (limit == "-" || limit == "") {
+        return ""
+    }
+    checked[name] = 1
+    if (used > limit) {
+        ++overruns
+        return sprintf("OVER %s budget %d by %d", kind, limit, used - limit)
+    }
+    return ""
+}
+
+function printModule (m,    status)
+{
+    status = checkBudget(m, "flash", flashOf(m))
+    if (status == "") {
+        status = checkBudget(m, "ram", ramOf(m))
+    }
+    printf "%-28s %6d %6d %6d %6d %6d %6d %6d %6d  %s\n", m,
+        usage[m, "text"], usage[m, "progmem"], usage[m, "data"],
+        usage[m, "bss"], usage[m, "noinit"], usage[m, "eeprom"],
+        flashOf(m), ramOf(m), status
+}
+
+{ sub(/\r$/, "") }
+
+# budgets
+FILENAME == ARGV[1] {
+    if ($0 !~ /^[ \t]*(#|$)/) {
+        flashBudget[$1] = $2
+        ramBudget[$1] = $3
+    }
+    next
+}
+
+# linker map
+FILENAME == ARGV[2] {
+    if (!inMemoryMap) {
+        inMemoryMap = /^Linker script and memory map/
+        next
+    }
+    if (/^\.[^ ]+ +0x/) {
+        outputSection = $1
+    } else if (/^ (\.[^ ]+|COMMON) +0x[0-9a-f]+ +0x[0-9a-f]+ /) {
+        path = $4
+        for (i = 5; i <= NF; ++i) {
+            path = path " " $i
+        }
+        addInputSection($1, hexValue($3), path)
+    } else if (/^ \.[^ ]+$/) {
+        # section name too long to share a line with its address
+        pendingSection = $1
+        next
+    } else if (pendingSection != "" && /^ +0x[0-9a-f]+ +0x[0-9a-f]+ /) {
+        path = $3
+        for (i = 4; i <= NF; ++i) {
+            path = path " " $i
+        }
+        addInputSection(pendingSection, hexValue($2), path)
+    }
+    pendingSection = ""
+    next
+}
+
+# symbols, sorted by increasing size: "<address> <size> <type> <name>"
+NF == 4 {
+    address = $1 + 0
+    size = $2 + 0
+    name = $4
+    if (address >= 8454144) {
+        next    # EEPROM
+    }
+    isRAM = (address >= 8388608)
+    if (name in flashBudget) {
+        status = checkBudget(name, isRAM ? "ram" : "flash", size)
+        if (status != "") {
+            overSymbols[name] = status
+        }
+    }
+    if ((isRAM && size >= ramSymbolMin) || (!isRAM && size >= flashSymbolMin) ||
+        (name in flashBudget)) {
+        symbols[++numSymbols] = sprintf("%-36s %6d %-5s %s", name, size,
+            isRAM ? "ram" : "flash", overSymbols[name])
+    }
+}
+
+END {
+    printf "%-28s %6s %6s %6s %6s %6s %6s %6s %6s\n", "module",
+        "text", "pgm", "data", "bss", "noinit", "eeprom", "flash", "ram"
+    for (i = 1; i <= numModules; ++i) {
+        printModule(modules[i])
+    }
+    printModule("TOTAL")
+
+    printf "\n%-36s %6s\n", "symbol", "size"
+    for (i = numSymbols; i >= 1; --i) {
+        print symbols[i]
+    }
+
+    for (name in flashBudget) {
+        if (!(name in checked) && !(name in seen) && name != "TOTAL" &&
+            (flashBudget[name] != "-" || ramBudget[name] != "-")) {
+            printf "\nbudget for %s: not found in map or symbols\n", name
+        }
+    }
+    if (overruns > 0) {
+        printf "\n%d budget(s) exceeded\n", overruns
+        exit 1
+    }
+}
@@ -0,0 +1,310 @@
+#
+#  StackUsage.awk
+#
+#  What it does:
+#    Works out the worst-case stack depth of main() and of each interrupt
+#    handler, and of main() with an interrupt taken at its deepest point.
+#    Frame sizes come from the .su files written by -fstack-usage, and the
+#    call graph from the disassembly (call, rcall, and jmp/rjmp to another
+#    function, which is a tail call). Indirect calls (icall, ijmp) are
+#    resolved with the annotations file. Exits with status 1 if the bound
+#    can't be proven (an unresolved indirect call, a frame of dynamic size
+#    or undeclared recursion) or if it exceeds the RAM left for the stack.
+#
+#  Usage:
+#    cat *.su > WaterLevelMonitor.frames
+#    avr-objdump -d WaterLevelMonitor.elf > WaterLevelMonitor.dis
+#    awk -v ramEnd=0x8FF -f StackUsage.awk StackCallees.txt \
+#        WaterLevelMonitor.map WaterLevelMonitor.frames WaterLevelMonitor.dis
+#
+#  Annotations file lines:
+#    indirect <where> <target>...   functions that indirect calls can reach
+#                                   from where, which is a function or else
+#                                   a module (an object file) for all the
+#                                   functions in it. /regex/ matches
+#                                   function names
+#    recursive <function> <n>       function may be active n times at once
+#    frame <function> <bytes>       frame size of a function that has no
+#                                   .su entry (assembly library routines)
+#
+#  The frame sizes from -fstack-usage include the return address and the
+#  registers pushed by the prologue. Library routines with no .su entry
+#  are assumed to use only their return address unless annotated.
+#
+
+function hexValue (s,    i, v)
+{
+    s = tolower(s)
+    sub(/^0x/, "", s)
+    v = 0
+    for (i = 1; i <= length(s); ++i) {
+        v = (v * 16) + index("0123456789abcdef", substr(s, i, 1)) - 1
+    }
+    return v
+}
+
+function moduleAt (address,    i)
+{
+    for (i = 1; i <= numModules; ++i) {
+        if ((address >= moduleStart[i]) && (address < moduleEnd[i])) {
+            return moduleName[i]
+        }
+    }
+    return ""
+}
+
+function addEdge (caller, callee)
+{
+    # a function that calls itself gets an edge to itself too, so that
+    # worstDepth() sees the recursion
+    if ((caller, callee) in isEdge) {
+        return
+    }
+    isEdge[caller, callee] = 1
+    callees[caller, ++numCallees[caller]] = callee
+}
+
+function frameOf (f)
+{
+    if (f in suFrame) {
+        return suFrame[f]
+    }
+    if (f in annotatedFrame) {
+        return annotatedFrame[f]
+    }
+    assumedFrame[f] = 1
+    return 2    # return address
+}
+
+# worst-case stack depth of f and everything it calls. results are only
+# memoized if no recursion was cut short below f, since those depend on
+# the path that led to f
+function worstDepth (f,    i, c, d, best, bestCallee, cutBelow, total)
+{
+    if (f in memo) {
+        return memo[f]
+    }
+    if (activeCount[f] >= ((f in recursionLimit) ? recursionLimit[f] : 1)) {
+        # the cycle back to f is bounded if it goes through a function that
+        # is declared recursive
+        for (i = pathLength; (i >= 1) && (activePath[i] != f); --i) {
+            if (activePath[i] in recursionLimit) {
+                break
+            }
+        }
+        if (!(f in recursionLimit) && ((i < 1) || (activePath[i] == f))) {
+            undeclaredRecursion[f] = 1
+        }
+        recursionCut = 1
+        return 0
+    }
+    if (f in hasDynamicFrame) {
+        unbounded[f] = 1
+    }
+    if ((f in hasIndirectCall) && !(f in indirectResolved)) {
+        unresolved[f] = 1
+    }
+
+    ++activeCount[f]
+    activePath[++pathLength] = f
+    cutBelow = 0
+    best = 0
+    bestCallee = ""
+    for (i = 1; i <= numCallees[f]; ++i) {
+        c = callees[f, i]
+        recursionCut = 0
+        d = worstDepth(c)
+        if (recursionCut) {
+            cutBelow = 1
+        }
+        if (d > best) {
+            best = d
+            bestCallee = c
+        }
+    }
+    --activeCount[f]
+    --pathLength
+
+    total = frameOf(f) + best
+    deepestCallee[f] = bestCallee
+    if (cutBelow) {
+        recursionCut = 1
+    } else {
+        memo[f] = total
+    }
+    return total
+}
+
+function deepestPath (f,    names, onPath)
+{
+    names = f
+    onPath[f] = 1
+    while ((deepestCallee[f] != "") && !(deepestCallee[f] in onPath)) {
+        f = deepestCallee[f]
+        onPath[f] = 1
+        names = names " > " f
+    }
+    return names
+}
+
+{ sub(/\r$/, "") }
+
+# annotations
+FILENAME == ARGV[1] {
+    if ($1 == "indirect") {
+        for (i = 3; i <= NF; ++i) {
+            indirectTargets[$2] = indirectTargets[$2] " " $i
+        }
+    } else if ($1 == "recursive") {
+        recursionLimit[$2] = $3
+    } else if ($1 == "frame") {
+        annotatedFrame[$2] = $3
+    }
+    next
+}
+
+# linker map: where each module's code is, and the end of static data
+FILENAME == ARGV[2] {
+    if (/^\.[^ ]+ +0x/) {
+        outputSection = $1
+    } else if ((outputSection == ".text") &&
+               /^ \.text +0x[0-9a-f]+ +0x[0-9a-f]+ [^ ]+\.o$/) {
+        objectFile = $4
+        sub(/.*[\/\\]/, "", objectFile)
+        ++numModules
+        moduleName[numModules] = objectFile
+        moduleStart[numModules] = hexValue($2)
+        moduleEnd[numModules] = hexValue($2) + hexValue($3)
+    } else if (/^ +0x[0-9a-f]+ +_end = \.$/) {
+        dataEnd = hexValue($1) - 8388608    # data addresses start at 0x800000
+    }
+    next
+}
+
+# stack usage: "file.c:line:column:function<TAB>bytes<TAB>qualifiers"
+FILENAME == ARGV[3] {
+    split($0, field, "\t")
+    name = field[1]
+    sub(/.*:/, "", name)
+    if (!(name in suFrame) || ((field[2] + 0) > suFrame[name])) {
+        # static functions in different modules can share a name
+        suFrame[name] = field[2] + 0
+    }
+    if (field[3] ~ /dynamic/ && field[3] !~ /bounded/) {
+        hasDynamicFrame[name] = 1
+    }
+    next
+}
+
+# disassembly
+/^[0-9a-f]+ <[^>]+>:$/ {
+    current = $2
+    gsub(/[<>:]/, "", current)
+    functionModule[current] = moduleAt(hexValue($1))
+    functions[++numFunctions] = current
+    next
+}
+
+current != "" && /\t(call|rcall|jmp|rjmp)\t/ && /<[^>+]+>$/ {
+    callee = $NF
+    gsub(/[<>]/, "", callee)
+    addEdge(current, callee)
+    next
+}
+
+current != "" && /\t(icall|eicall|ijmp|eijmp)/ {
+    # the table jump helpers jump back into their caller
+    if (current !~ /^__tablejump/) {
+        hasIndirectCall[current] = 1
+    }
+    next
+}
+
+current != "" && /\tsei/ {
+    enablesInterrupts[current] = 1
+}
+
+END {
+    if (ramEnd == "") {
+        ramEnd = "0x8FF"
+    }
+
+    # add the edges for indirect calls
+    for (f in hasIndirectCall) {
+        m = (f in indirectTargets) ? f : functionModule[f]
+        if (!(m in indirectTargets)) {
+            continue
+        }
+        indirectResolved[f] = 1
+        n = split(indirectTargets[m], target, " ")
+        for (i = 1; i <= n; ++i) {
+            if (target[i] ~ /^\/.*\/$/) {
+                re = substr(target[i], 2, length(target[i]) - 2)
+                for (j = 1; j <= numFunctions; ++j) {
+                    if (functions[j] ~ re) {
+                        addEdge(f, functions[j])
+                    }
+                }
+            } else {
+                addEdge(f, target[i])
+            }
+        }
+    }
+
+    printf "%-24s %6s  %s\n", "entry point", "bytes", "deepest path"
+    mainDepth = worstDepth("main")
+    printf "%-24s %6d  %s\n", "main", mainDepth, deepestPath("main")
+    deepestISR = 0
+    nestingISRs = 0
+    for (i = 1; i <= numFunctions; ++i) {
+        f = functions[i]
+        if ((f !~ /^__vector_[0-9]+$/) || (f in reported)) {
+            continue
+        }
+        reported[f] = 1
+        d = worstDepth(f)
+        printf "%-24s %6d  %s\n", f, d, deepestPath(f)
+        if (f in enablesInterrupts) {
+            # another interrupt can be taken on top of this one
+            nestingISRs += d
+        } else if (d > deepestISR) {
+            deepestISR = d
+        }
+    }
+
+    worstCase = mainDepth + deepestISR + nestingISRs
+    available = hexValue(ramEnd) + 1 - dataEnd
+    printf "\nworst case: main %d + deepest interrupt %d", mainDepth, deepestISR
+    if (nestingISRs > 0) {
+        printf " + interrupts that re-enable interrupts %d", nestingISRs
+    }
+    printf " = %d bytes\n", worstCase
+    printf "RAM between end of static data and top of stack: %d bytes\n", available
+
+    failed = 0
+    for (f in unresolved) {
+        printf "indirect call in %s (%s) not covered by the annotations\n", f, functionModule[f]
+        failed = 1
+    }
+    for (f in undeclaredRecursion) {
+        printf "recursion through %s is not declared in the annotations\n", f
+        failed = 1
+    }
+    for (f in unbounded) {
+        printf "%s has a frame of dynamic size\n", f
+        failed = 1
+    }
+    for (f in assumedFrame) {
+        assumed = assumed " " f
+    }
+    if (assumed != "") {
+        printf "no frame size for (assumed 2 bytes):%s\n", assumed
+    }
+    if (worstCase > available) {
+        printf "worst case exceeds the RAM left for the stack by %d bytes\n", worstCase - available
+        failed = 1
+    }
+    if (failed) {
+        exit 1
+    }
+}
@@ -10,7 +10,7 @@ var DISPLAY_PORT = 3010;
 var ThingSpeakPumpWritekey = "P55J3PTLW77TJFLB";
 
 var mainsock;
-var pendingCommand = '';
+var pendingCommands = [];
 
 var tankEmptyDistance = 284;
 var tankFullDistance = 30;
@@ -67,11 +67,11 @@ function isWithinBounds (value, bounds)
 //
 //  HTTP post to ThingSpeak
 //
-function postBulkDataToThingSpeak(bulkData) {
+function postBulkDataToThingSpeak(bulkData, timeFormat) {
     // Build the post string from the given data object
     var postData = {
        "write_api_key" : ThingSpeakSensorWritekey,
-       "time_format" : "relative",
+       "time_format" : timeFormat,
        "updates" : bulkData
     };
     var postDataStr = JSON.stringify(postData);
@@ -162,9 +162,48 @@ var sensorFieldDescriptors = {
    "B" : {fieldName : "field3",   divisor : 100 },
    "Q" : {fieldName : "field4",   divisor : 1   },
    "C" : {fieldName : "field5",   divisor : 1   },
-   "I" : {fieldName : "id",       divisor : 1   }
+   "I" : {fieldName : "id",       divisor : 1   },
+   "S" : {fieldName : "seq",      divisor : 1   },
+   "A" : {fieldName : "first_t",  divisor : 1   }
    };
 
+// fields of the per-post connection data that describe the health of the
+// monitor itself. they are logged rather than posted
+var sensorHealthDescriptors = {
+   "K" : {fieldName : "stack_high_water", divisor : 1 },
+   "F" : {fieldName : "ram_free",         divisor : 1 },
+   "J" : {fieldName : "stack_task",       divisor : 1 },
+   "G" : {fieldName : "registration_time", divisor : 10 },
+   "H" : {fieldName : "network_selection", divisor : 1 },
+   "E" : {fieldName : "teardown_time",    divisor : 100 },
+   "O" : {fieldName : "last_session_outcome", divisor : 1 },
+   "L" : {fieldName : "last_session_time", divisor : 10 },
+   "P" : {fieldName : "posts_deferred",   divisor : 1 },
+   "N" : {fieldName : "alert_latency",    divisor : 10 }
+   };
+
+// fields of the level alert that a monitor sends ahead of the per-post
+// connection data when the water level goes out of range
+var sensorAlertDescriptors = {
+   "I" : {fieldName : "id",       divisor : 1   },
+   "P" : {fieldName : "level",    divisor : 1   },
+   "W" : {fieldName : "distance", divisor : 10  },
+   "C" : {fieldName : "age",      divisor : 1   }
+   };
+var alertStateNames = { "L" : "low", "H" : "high" };
+
+// sequence number of the last sample accepted from each sensor unit.
+// samples that are sent again are discarded
+var lastAcceptedSeq = {};
+// a unit resends at most this many samples, so a sequence number further
+// back than this means that the unit's numbering has started over
+var maxResendSamples = 30;
+// how long the feed has to be idle before the samples received so far are
+// acknowledged (ms). this has to be shorter than the time a monitor waits
+// for an ack after a failed send (5s), but long enough to ride out the
+// gaps between chunks of a GPRS upload
+var partialFeedTimeout = 3000;
+
 // sets a field of sample from the given fieldStr. fieldStr
 // is expected to be an uppercase letter followed by a number
 function parseField(fieldStr, fieldDescriptors, sample)  {
@@ -176,28 +215,129 @@ function parseField(fieldStr, fieldDescriptors, sample)  {
     }
 }
 
-function parseSensorDataFeed(sensorDataStr) {
-    var packetStrs = sensorDataStr.match(/[0-9A-Z\-]+;/g);
-    var connDataStr = packetStrs[0];
-    // parse sample data
-    var fieldRE = new RegExp("\\w-?\\d+", "g");
-    var samples = [];
-    for (i = 1; i < packetStrs.length; ++i) {
-        var sampleStr = packetStrs[i];
-        var sample = {"delta_t" : 0};
-        var sampleFields = sampleStr.match(fieldRE);
-        for (f in sampleFields) {
-           parseField(sampleFields[f], sensorFieldDescriptors, sample);
+var fieldRE = new RegExp("\\w-?\\d+", "g");
+
+// The sensor data feed is one line: a packet of per-post connection data
+// followed by a packet per sample, each terminated by ';', and then 'Z'.
+// Packets are handled as they arrive so that the samples that got through
+// can be kept, and acknowledged, when a post is cut short. They are posted
+// when the 'Z' arrives, or when the feed is cut short, once the monitor
+// starts over with a new header or the connection closes. Monitors that
+// number their samples (S field) send the time of the first sample (A
+// field), so sample times are worked out going forward.
+// A level alert packet, starting with '!' and the level state, may come
+// first. It is acted on straight away, before the samples arrive.
+
+// handles a level alert packet (without its ';')
+function handleSensorAlert(packetStr) {
+    var alert = {};
+    var fields = packetStr.substring(2).match(fieldRE);
+    for (x in fields) {
+        parseField(fields[x], sensorAlertDescriptors, alert);
+    }
+    var stateName = alertStateNames[packetStr.charAt(1)] || packetStr.charAt(1);
+    console.log('ALERT unit ' + alert.id + ' level ' + stateName + ' at ' +
+        alert.level + '% (' + alert.age + 's ago)');
+    if ((alert.id == LoJASensorUnitId) && ("distance" in alert)) {
+        // let the display have the new level without waiting for the samples
+        latestWaterLevel.level = waterLevelFromDistance(alert.distance);
+        latestWaterLevel.timestamp = gpsTime(new Date()) - alert.age;
+    }
+}
+
+// handles one packet (without its ';') of the feed on sock.
+// returns false if the feed is invalid
+function handleSensorPacket(sock, packetStr) {
+    // a send that failed part way leaves a partial packet, which runs into
+    // the header that the monitor starts over with. drop the partial packet
+    var headerStart = packetStr.indexOf('I', (packetStr.charAt(0) == '!') ? 3 : 0);
+    if (headerStart > 0) {
+        console.log('discarding partial packet ' + packetStr.substring(0, headerStart));
+        packetStr = packetStr.substring(headerStart);
+    }
+    var feed = sock.sensorFeed;
+    if (feed && (packetStr.charAt(0) == 'I')) {
+        // the monitor is starting over. keep what got through of the
+        // previous feed, and start a new one
+        postSensorSamples(sock);
+        sock.sensorFeed = feed = undefined;
+    }
+    var fields = packetStr.match(fieldRE);
+    if (!feed) {
+        if (packetStr.charAt(0) == '!') {
+            handleSensorAlert(packetStr);
+            return true;
+        }
+        // first packet is per-post connection data
+        if (packetStr.charAt(0) != 'I') {
+            return false;
+        }
+        feed = { "conn" : {}, "health" : {}, "samples" : [] };
+        for (x in fields) {
+            parseField(fields[x], sensorFieldDescriptors, feed.conn);
+            parseField(fields[x], sensorHealthDescriptors, feed.health);
+        }
+        if (Object.keys(feed.health).length > 0) {
+            console.log('unit ' + feed.conn.id + ' health: ' + JSON.stringify(feed.health));
+        }
+        if ("seq" in feed.conn) {
+            feed.nextSeq = feed.conn.seq;
+            var lastSeq = lastAcceptedSeq[feed.conn.id];
+            if ((lastSeq !== undefined) &&
+                ((feed.conn.seq + maxResendSamples) < lastSeq)) {
+                console.log('unit ' + feed.conn.id + ' sequence restarted at ' + feed.conn.seq);
+                delete lastAcceptedSeq[feed.conn.id];
+            }
         }
-        samples.push(sample);
+        sock.sensorFeed = feed;
+        return true;
     }
 
-	// set timestamps on samples
-	var sampleTime = gpsTime(new Date());
-	for (i = samples.length - 1; i >= 0; --i) {
-		samples[i].abs_t = sampleTime;
-		sampleTime -= samples[i].delta_t;
-	}
+    var sample = {"delta_t" : 0};
+    for (f in fields) {
+       parseField(fields[f], sensorFieldDescriptors, sample);
+    }
+    if (feed.nextSeq === undefined) {
+        // monitor doesn't number its samples
+        feed.samples.push(sample);
+        return true;
+    }
+
+    // work out the sample's time from the time of the first sample
+    sample.abs_t = (feed.sampleTime === undefined)
+        ? feed.conn.first_t
+        : (feed.sampleTime + sample.delta_t);
+    feed.sampleTime = sample.abs_t;
+
+    var seq = feed.nextSeq++;
+    var lastSeq = lastAcceptedSeq[feed.conn.id];
+    if ((lastSeq !== undefined) && (seq <= lastSeq)) {
+        console.log('discarding duplicate sample ' + seq);
+    } else {
+        lastAcceptedSeq[feed.conn.id] = seq;
+        feed.samples.push(sample);
+    }
+    return true;
+}
+
+// posts the samples of the feed on sock that haven't been posted yet
+function postSensorSamples(sock) {
+    var feed = sock.sensorFeed;
+    var samples = feed.samples;
+    if (samples.length == 0) {
+        return;
+    }
+    feed.samples = [];
+    var numbered = (feed.nextSeq !== undefined);
+
+    if (!numbered) {
+        // set timestamps on samples, working back from now
+        var sampleTime = gpsTime(new Date());
+        for (i = samples.length - 1; i >= 0; --i) {
+            samples[i].abs_t = sampleTime;
+            sampleTime -= samples[i].delta_t;
+        }
+    }
 
 	// filter samples with simple Kalman-like filter.
 	// for good samples compute water level from distance to water.
@@ -222,29 +362,97 @@ function parseSensorDataFeed(sensorDataStr) {
 		} else {
 			console.log('>>> rejecting sample distance ' + distance + " (out of bounds " + bounds.low + ".." + bounds.high + ")");
 		}
+		if (numbered) {
+			// post with absolute times
+			samples[s].created_at = new Date(gpsStart + (samples[s].abs_t * 1000)).toISOString();
+			delete samples[s].delta_t;
+		}
 		// clear out abs_t - it's only needed for this filter
 		delete samples[s].abs_t;
 	}
 	
     // set connection data on last sample
     var lastSample = samples[samples.length-1];
-    var connFields = connDataStr.match(fieldRE);
-    for (x in connFields) {
-        parseField(connFields[x], sensorFieldDescriptors, lastSample);
+    for (var field in feed.conn) {
+        lastSample[field] = feed.conn[field];
     }
+    delete lastSample.seq;
+    delete lastSample.first_t;
     
     if (lastSample.id == LoJASensorUnitId) {
         // send to ThingSpeak
 		delete lastSample.id; // we don't post the id
-        postBulkDataToThingSpeak(samples);
+        postBulkDataToThingSpeak(samples, numbered ? "absolute" : "relative");
     } else {
         console.log('got data from alternate sensor ' + lastSample.id);
     }
 }
+
+// tells the monitor which samples we have, so that it doesn't send them again
+function acknowledgeSensorSamples(sock) {
+    var feed = sock.sensorFeed;
+    var lastSeq = lastAcceptedSeq[feed.conn.id];
+    if ((feed.nextSeq !== undefined) && (lastSeq !== undefined)) {
+        sock.write('ack ' + lastSeq + '\r');
+    }
+}
+
+// the feed has stalled part way through (e.g. the monitor's send failed).
+// tell the monitor what did get through. the samples are posted when the
+// feed finishes, starts over or is closed
+function partialSensorFeedTimeout(sock) {
+    sock.partialFeedTimer = undefined;
+    if (sock.sensorFeed && !sock.destroyed) {
+        acknowledgeSensorSamples(sock);
+    }
+}
 //
 // end of parse sensor data and send to ThingSpeak
 //
 
+// the monitor queues up to this many bytes of commands (each command and
+// its terminator), keeping 2 of its 128 spare. a longer command block is
+// sent in pieces, each one after the replies to the one before it have
+// come back. in a block every command but '[' and ']' gets a reply line
+var monitorCommandQueueLen = 126;
+
+// splits the given commands into pieces that fit in the monitor's queue,
+// and sends the first piece
+function sendCommandBlock(sock, commands) {
+    var pieces = [];
+    var piece = { "text" : '', "replies" : 0 };
+    for (c in commands) {
+        var cmd = commands[c];
+        if ((piece.text.length > 0) &&
+            ((piece.text.length + cmd.length + 1) > monitorCommandQueueLen)) {
+            pieces.push(piece);
+            piece = { "text" : '', "replies" : 0 };
+        }
+        piece.text += cmd + '\r';
+        if ((cmd != '[') && (cmd != ']')) {
+            piece.replies++;
+        }
+    }
+    pieces.push(piece);
+    sock.commandPieces = pieces;
+    sendNextCommandPiece(sock);
+}
+
+function sendNextCommandPiece(sock) {
+    var piece = sock.commandPieces.shift();
+    if (piece) {
+        sock.write(piece.text);
+        sock.pendingReplies = piece.replies;
+    }
+}
+
+// a line of reply has come back from the monitor
+function commandReplyReceived(sock) {
+    if ((sock.pendingReplies > 0) && (--sock.pendingReplies == 0)) {
+        sendNextCommandPiece(sock);
+    }
+}
+
 //
 //  water level monitor net server
 //
@@ -257,6 +465,10 @@ var waterLevelMonitorServer = net.createServer(function(sock) {
 
     sock["incomingData"] = '';
     sock["incomingDataLineNumber"] = 0;
+    sock["sensorFeed"] = undefined;
+    sock["partialFeedTimer"] = undefined;
+    sock["commandPieces"] = [];
+    sock["pendingReplies"] = 0;
     mainsock = sock;
     // Add a 'data' event handler to this instance of socket
     sock.on('data', function(data) {
@@ -264,28 +476,46 @@ var waterLevelMonitorServer = net.createServer(function(sock) {
         var now = new Date();
         console.log('DATA ' + now.toDateString() + " " + now.toLocaleTimeString() + ': ' +
             dataString + ', line: ' + sock.incomingDataLineNumber);
+        if (sock.partialFeedTimer) {
+            clearTimeout(sock.partialFeedTimer);
+            sock.partialFeedTimer = undefined;
+        }
         for (chIndex in dataString) {
+            var ch = dataString.charAt(chIndex);
             if (dataString.charCodeAt(chIndex) == 10) {
                 // end of line
                 sock.incomingDataLineNumber++;
                 if (sock.incomingDataLineNumber == 1) {
                     // first line is sensor data
                     // validate
-                    if ((sock.incomingData.charAt(0) == 'I') && 
-                        (sock.incomingData.charAt(sock.incomingData.length-1) == 'Z')) {
-                        // parse the data
-                        parseSensorDataFeed(sock.incomingData);
+                    if (sock.sensorFeed && (sock.incomingData == 'Z')) {
+                        postSensorSamples(sock);
+                        acknowledgeSensorSamples(sock);
                     } else {
                         console.log('>>>> unexpected input - destroy socket');
                         sock.destroy('unexpected');
                         break;
                     }
+                } else {
+                    commandReplyReceived(sock);
+                }
+                sock.incomingData = '';
+            } else if ((ch == ';') && (sock.incomingDataLineNumber == 0)) {
+                // end of sensor data packet
+                if (!handleSensorPacket(sock, sock.incomingData)) {
+                    console.log('>>>> unexpected input - destroy socket');
+                    sock.destroy('unexpected');
+                    break;
                 }
                 sock.incomingData = '';
             } else {
-                sock.incomingData += dataString.charAt(chIndex);
+                sock.incomingData += ch;
             }
         }                
+        if (sock.sensorFeed && (sock.incomingDataLineNumber == 0) && !sock.destroyed) {
+            // sensor data line not finished yet
+            sock.partialFeedTimer = setTimeout(partialSensorFeedTimeout, partialFeedTimeout, sock);
+        }
     });
     
     // Add a 'close' event handler to this instance of socket
@@ -293,24 +523,39 @@ var waterLevelMonitorServer = net.createServer(function(sock) {
         var now = new Date();
         console.log('CLOSED ' + now.toDateString() + " " + now.toLocaleTimeString() + ': '+
             sock.remotePort);
+        if (sock.partialFeedTimer) {
+            clearTimeout(sock.partialFeedTimer);
+            sock.partialFeedTimer = undefined;
+        }
+        if (sock.sensorFeed) {
+            // keep whatever samples got through
+            postSensorSamples(sock);
+        }
         mainsock = undefined;
-        pendingCommand = '';
+        pendingCommands = [];
     });
 
     sock.on('error', function(exception) {
         var now = new Date();
         console.log('ERROR ' + now.toDateString() + " " + now.toLocaleTimeString() + ': ' +
             exception);
-        pendingCommand = '';
+        pendingCommands = [];
     });
 
     var setTimeCmd = 'tset ' + gpsTime(now);
-    if (pendingCommand.length > 0) {
-        console.log('sending block start');
-        sock.write('[\r');
-        pendingCommand = '';
+    if (pendingCommands.length > 0) {
+        // send the command block in as few pieces as fit in the monitor's
+        // queue. the monitor queues the commands, executes them
+        // back-to-back and returns all of their replies in a single
+        // upload. the block stays open for commands typed while connected
+        // unless one of the pending commands is ']'
+        console.log('sending command block: ' + pendingCommands.join('; '));
+        sendCommandBlock(sock, ['[', setTimeCmd].concat(pendingCommands));
+
+        pendingCommands = [];
+    } else {
+        sock.write(setTimeCmd + '\r');
     }
-    sock.write(setTimeCmd + '\r');
 });
 //
 //  end of water level monitor net server
@@ -399,22 +644,22 @@ var waterLevelDisplayServer = net.createServer(function(sock) {
         console.log('display CLOSED ' + now.toDateString() + " " + now.toLocaleTimeString() + ': '+
             sock.remotePort);
         mainsock = undefined;
-        pendingCommand = '';
+        pendingCommands = [];
     });
 
     sock.on('error', function(exception) {
         var now = new Date();
         console.log('display ERROR ' + now.toDateString() + " " + now.toLocaleTimeString() + ': ' +
             exception);
-        pendingCommand = '';
+        pendingCommands = [];
     });
     
     var dataCmd = 'data ' + latestWaterLevel.level + ' ' + latestWaterLevel.timestamp + ' ' + gpsTime(now);
     console.log(dataCmd);
-    if (pendingCommand.length > 0) {
+    if (pendingCommands.length > 0) {
         console.log('sending block start');
         sock.write('[\r');
-        pendingCommand = '';
+        pendingCommands = [];
     }
     sock.write(dataCmd + '\r');
 });
@@ -437,7 +682,7 @@ rl.on('line', function(line){
         mainsock.write(line + '\r');
     } else {
         console.log('buffering pending command: ' + line);
-        pendingCommand = line;
+        pendingCommands.push(line);
     }
 });
 //